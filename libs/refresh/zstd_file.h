@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <string>
+#include <vector>
 
 #include "../../libs/zstd/lib/zstd.h"
 
@@ -17,6 +18,9 @@ namespace refresh
 		working_mode_t working_mode;
 		FILE* fio;
 
+		// writing: if set, compressed data is appended to it instead of fio (e.g. a bin stored later in a container)
+		std::vector<uint8_t>* mem_out = nullptr;
+
 		size_t io_buffer_size;
 		size_t zstd_buffer_size;
 
@@ -25,9 +29,47 @@ namespace refresh
 		ZSTD_CStream *zstd_cstream;
 		ZSTD_DStream *zstd_dstream;
 
+		// digested dictionaries, owned by the caller, may be shared by many files
+		const ZSTD_CDict* cdict = nullptr;
+		const ZSTD_DDict* ddict = nullptr;
+
 		ZSTD_inBuffer zstd_read_buffer;
 		bool read_eof;
 
+		// writing: false only just after end_frame(), so closing does not append an empty frame
+		bool frame_pending = true;
+
+		// reading: if multi_frame is set, consecutive frames are read until read_end_offset
+		bool multi_frame = false;
+		uint64_t read_file_pos = 0;
+		uint64_t read_end_offset = 0;
+
+		static int fseek64(FILE* f, uint64_t offset)
+		{
+#ifdef _WIN32
+			return _fseeki64(f, static_cast<int64_t>(offset), SEEK_SET);
+#else
+			return fseeko(f, static_cast<off_t>(offset), SEEK_SET);
+#endif
+		}
+
+		static uint64_t ftell64(FILE* f)
+		{
+#ifdef _WIN32
+			return static_cast<uint64_t>(_ftelli64(f));
+#else
+			return static_cast<uint64_t>(ftello(f));
+#endif
+		}
+
+		bool write_out(const void* p, size_t size)
+		{
+			if (!mem_out)
+				return fwrite(p, 1, size, fio) == size;
+			mem_out->insert(mem_out->end(), static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + size);
+			return true;
+		}
+
 		void flush()
 		{
 			ZSTD_inBuffer zstd_in_buffer;
@@ -45,7 +87,7 @@ namespace refresh
 			{
 				zstd_out_buffer.pos = 0;
 				need_work = ZSTD_compressStream2(zstd_cstream, &zstd_out_buffer, &zstd_in_buffer, ZSTD_e_end) != 0;
-				fwrite(zstd_out_buffer.dst, 1, zstd_out_buffer.pos, fio);
+				write_out(zstd_out_buffer.dst, zstd_out_buffer.pos);
 			}
 		}
 
@@ -62,15 +104,39 @@ namespace refresh
 			working_mode = working_mode_t::none;
 		}
 
+		// the current frame is finished and the output is released
+		void finish_output()
+		{
+			if (frame_pending)
+				flush();
+
+			if (fio)
+				fclose(fio);
+			fio = nullptr;
+			mem_out = nullptr;
+		}
+
+		void start_writing()
+		{
+			working_mode = working_mode_t::writing;
+
+			allocate_buffers();
+
+			zstd_cstream = ZSTD_createCStream();
+
+			ZSTD_initCStream(zstd_cstream, compression_level);
+			if (cdict)
+				ZSTD_CCtx_refCDict(zstd_cstream, cdict);
+
+			frame_pending = true;
+		}
+
 		void close_writing()
 		{
-			if (!fio)
+			if (!fio && !mem_out)
 				return;
 
-			flush();
-
-			fclose(fio);
-			fio = nullptr;
+			finish_output();
 
 			ZSTD_freeCStream(zstd_cstream);
 			zstd_cstream = nullptr;
@@ -124,6 +190,9 @@ namespace refresh
 			fio = rhs.fio;
 			rhs.fio = nullptr;
 
+			mem_out = rhs.mem_out;
+			rhs.mem_out = nullptr;
+
 			compression_level = rhs.compression_level;
 
 			io_buffer_size = rhs.io_buffer_size;
@@ -145,11 +214,18 @@ namespace refresh
 			rhs.zstd_read_buffer.src = nullptr;
 
 			read_eof = rhs.read_eof;
+			frame_pending = rhs.frame_pending;
+			multi_frame = rhs.multi_frame;
+			read_file_pos = rhs.read_file_pos;
+			read_end_offset = rhs.read_end_offset;
+
+			cdict = rhs.cdict;
+			ddict = rhs.ddict;
 		};
 
 		zstd_file& operator=(zstd_file&& rhs)
 		{
-			if (fio)
+			if (fio || mem_out)
 				close();
 
 			working_mode = rhs.working_mode;
@@ -158,6 +234,9 @@ namespace refresh
 			fio = rhs.fio;
 			rhs.fio = nullptr;
 
+			mem_out = rhs.mem_out;
+			rhs.mem_out = nullptr;
+
 			compression_level = rhs.compression_level;
 
 			io_buffer_size = rhs.io_buffer_size;
@@ -191,6 +270,13 @@ namespace refresh
 			rhs.zstd_read_buffer.src = nullptr;
 
 			read_eof = rhs.read_eof;
+			frame_pending = rhs.frame_pending;
+			multi_frame = rhs.multi_frame;
+			read_file_pos = rhs.read_file_pos;
+			read_end_offset = rhs.read_end_offset;
+
+			cdict = rhs.cdict;
+			ddict = rhs.ddict;
 
 			return *this;
 		};
@@ -220,6 +306,20 @@ namespace refresh
 				compression_level = _compression_level;
 		}
 
+		// dictionary used for compression of files opened later (nullptr means no dictionary)
+		void set_cdict(const ZSTD_CDict* _cdict)
+		{
+			if (working_mode == working_mode_t::none)
+				cdict = _cdict;
+		}
+
+		// dictionary used for decompression of files opened later (nullptr means no dictionary)
+		void set_ddict(const ZSTD_DDict* _ddict)
+		{
+			if (working_mode == working_mode_t::none)
+				ddict = _ddict;
+		}
+
 		void set_io_buffer_size(size_t _io_buffer_size)
 		{
 			if (working_mode == working_mode_t::none)
@@ -278,8 +378,12 @@ namespace refresh
 			zstd_read_buffer.size = 0;
 
 			read_eof = false;
+			multi_frame = false;
+			read_file_pos = 0;
 
 			ZSTD_initDStream(zstd_dstream);
+			if (ddict)
+				ZSTD_DCtx_refDDict(zstd_dstream, ddict);
 
 			return true;
 		}
@@ -295,13 +399,113 @@ namespace refresh
 
 			setvbuf(fio, nullptr, _IOFBF, io_buffer_size);
 
-			working_mode = working_mode_t::writing;
+			start_writing();
 
-			allocate_buffers();
+			return true;
+		}
 
-			zstd_cstream = ZSTD_createCStream();
+		// compressed data is appended to out, which must live until the file is closed (or reopened)
+		bool open_writing(std::vector<uint8_t>& out)
+		{
+			if (working_mode != working_mode_t::none)
+				return false;
 
-			ZSTD_initCStream(zstd_cstream, compression_level);
+			mem_out = &out;
+
+			start_writing();
+
+			return true;
+		}
+
+		// finish the current file and continue writing to a new one, compression context and buffers are reused
+		bool reopen_writing(const std::string& file_name)
+		{
+			if (working_mode != working_mode_t::writing)
+				return open_writing(file_name);
+
+			finish_output();
+
+			fio = fopen(file_name.c_str(), "wb");
+			if (!fio)
+			{
+				ZSTD_freeCStream(zstd_cstream);
+				zstd_cstream = nullptr;
+				working_mode = working_mode_t::none;
+				return false;
+			}
+
+			setvbuf(fio, nullptr, _IOFBF, io_buffer_size);
+
+			ZSTD_CCtx_reset(zstd_cstream, ZSTD_reset_session_only);
+
+			frame_pending = true;
+
+			return true;
+		}
+
+		// as above, but compressed data is appended to out
+		bool reopen_writing(std::vector<uint8_t>& out)
+		{
+			if (working_mode != working_mode_t::writing)
+				return open_writing(out);
+
+			finish_output();
+
+			mem_out = &out;
+
+			ZSTD_CCtx_reset(zstd_cstream, ZSTD_reset_session_only);
+
+			frame_pending = true;
+
+			return true;
+		}
+
+		// finish the current zstd frame, data written later starts a new frame that may be decompressed independently
+		bool end_frame()
+		{
+			if (working_mode != working_mode_t::writing)
+				return false;
+
+			if (frame_pending)
+				flush();
+			frame_pending = false;
+
+			return true;
+		}
+
+		// position in the compressed file, e.g. of the next frame just after end_frame()
+		uint64_t tell()
+		{
+			return mem_out ? mem_out->size() : ftell64(fio);
+		}
+
+		// write not compressed data directly to the file (only between frames, e.g. a footer)
+		bool write_raw(const char* p, size_t size)
+		{
+			if (working_mode != working_mode_t::writing || frame_pending)
+				return false;
+
+			return write_out(p, size);
+		}
+
+		// continue reading from a frame starting at offset, consecutive frames are read until end_offset
+		bool seek_reading(uint64_t offset, uint64_t end_offset)
+		{
+			if (working_mode != working_mode_t::reading)
+				return false;
+
+			if (fseek64(fio, offset))
+				return false;
+
+			ZSTD_DCtx_reset(zstd_dstream, ZSTD_reset_session_only);
+
+			zstd_read_buffer.pos = 0;
+			zstd_read_buffer.size = 0;
+
+			multi_frame = true;
+			read_file_pos = offset;
+			read_end_offset = end_offset;
+			read_eof = offset >= end_offset;
 
 			return true;
 		}
@@ -316,6 +520,9 @@ namespace refresh
 			if (working_mode != working_mode_t::writing)
 				return false;
 
+			if (size)
+				frame_pending = true;
+
 			ZSTD_inBuffer zstd_in_buffer;
 			ZSTD_outBuffer zstd_out_buffer;
 
@@ -331,7 +538,7 @@ namespace refresh
 			{
 				ZSTD_compressStream2(zstd_cstream, &zstd_out_buffer, &zstd_in_buffer, ZSTD_e_continue);
 
-				fwrite(zstd_out_buffer.dst, 1, zstd_out_buffer.pos, fio);
+				write_out(zstd_out_buffer.dst, zstd_out_buffer.pos);
 				zstd_out_buffer.pos = 0;
 			}
 
@@ -356,15 +563,33 @@ namespace refresh
 			{
 				if (zstd_read_buffer.pos == zstd_read_buffer.size)
 				{
+					size_t to_read = zstd_buffer_size;
+					if (multi_frame && read_end_offset - read_file_pos < to_read)
+						to_read = read_end_offset - read_file_pos;
 					zstd_read_buffer.pos = 0;
-					zstd_read_buffer.size = fread((void*)zstd_read_buffer.src, 1, zstd_buffer_size, fio);
+					zstd_read_buffer.size = fread((void*)zstd_read_buffer.src, 1, to_read, fio);
+					read_file_pos += zstd_read_buffer.size;
+
+					if (multi_frame && zstd_read_buffer.size == 0)
+					{
+						read_eof = true;
+						break;
+					}
 				}
 
 				zstd_out_buffer.dst = p + readed;
 				zstd_out_buffer.pos = 0;
 				zstd_out_buffer.size = size - readed;
 
-				read_eof = ZSTD_decompressStream(zstd_dstream, &zstd_out_buffer, &zstd_read_buffer) == 0;
+				bool frame_end = ZSTD_decompressStream(zstd_dstream, &zstd_out_buffer, &zstd_read_buffer) == 0;
+				if (multi_frame)
+					read_eof = frame_end && zstd_read_buffer.pos == zstd_read_buffer.size && read_file_pos == read_end_offset;
+				else
+					read_eof = frame_end;
+
+				// truncated file: no more input and nothing more to decompress
+				if (zstd_read_buffer.size == 0 && zstd_out_buffer.pos == 0)
+					read_eof = true;
 
 				readed += zstd_out_buffer.pos;
 			}
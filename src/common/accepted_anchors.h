@@ -1,40 +1,176 @@
 #pragma once
 #include "../common/satc_data.h"
-#include <unordered_set>
+#include "../common/murmur64.h"
+#include <vector>
+
+//anchors are first checked in a Bloom filter, so most of not accepted anchors are rejected without touching the exact set
+//exact set is an open addressing (linear probing) hash table
 class AcceptedAnchors {
-	std::unordered_set<uint64_t> accepted_anchors;
+	static constexpr uint32_t bloom_bits_per_anchor = 16;
+	static constexpr uint32_t bloom_n_hashes = 3;
+	static constexpr uint64_t empty_slot = ~0ull; //such an anchor (all Ts of len 32) is handled separately
+
+	std::vector<uint64_t> bloom;
+	uint64_t bloom_mask{};
+
+	std::vector<uint64_t> slots;
+	uint64_t slots_mask{};
+	uint32_t slots_shift{};
+	bool contains_empty_slot_anchor = false;
+	uint64_t n_anchors{};
+
+	std::vector<uint64_t> sorted_anchors; //for jumping to the next accepted anchor in indexed files
+
 	bool use_filter = false;
+
+	static uint64_t round_up_pow2(uint64_t x) {
+		uint64_t res = 1;
+		while (res < x)
+			res <<= 1;
+		return res;
+	}
+
+	uint64_t slot_pos(uint64_t anchor) const {
+		return (anchor * 0x9E3779B97F4A7C15ull) >> slots_shift;
+	}
+
+	bool bloom_contains(uint64_t h) const {
+		uint64_t h1 = h & 0xffffffffull;
+		uint64_t h2 = (h >> 32) | 1;
+		for (uint32_t i = 0; i < bloom_n_hashes; ++i) {
+			uint64_t pos = (h1 + i * h2) & bloom_mask;
+			if (!(bloom[pos / 64] & (1ull << (pos % 64))))
+				return false;
+		}
+		return true;
+	}
+
+	void bloom_insert(uint64_t h) {
+		uint64_t h1 = h & 0xffffffffull;
+		uint64_t h2 = (h >> 32) | 1;
+		for (uint32_t i = 0; i < bloom_n_hashes; ++i) {
+			uint64_t pos = (h1 + i * h2) & bloom_mask;
+			bloom[pos / 64] |= 1ull << (pos % 64);
+		}
+	}
+
+	void insert(uint64_t anchor) {
+		if (anchor == empty_slot) {
+			if (!contains_empty_slot_anchor)
+				++n_anchors;
+			contains_empty_slot_anchor = true;
+		}
+		else {
+			auto pos = slot_pos(anchor);
+			while (slots[pos] != empty_slot && slots[pos] != anchor)
+				pos = (pos + 1) & slots_mask;
+			if (slots[pos] == empty_slot)
+				++n_anchors;
+			slots[pos] = anchor;
+		}
+		bloom_insert(MurMur64Hash{}(anchor));
+	}
+
+	void make_sorted() {
+		sorted_anchors.clear();
+		sorted_anchors.reserve(n_anchors);
+		for (auto x : slots)
+			if (x != empty_slot)
+				sorted_anchors.push_back(x);
+		if (contains_empty_slot_anchor)
+			sorted_anchors.push_back(empty_slot);
+		std::sort(sorted_anchors.begin(), sorted_anchors.end());
+	}
+
+	//load factor of exact set is at most 0.5
+	void init(uint64_t max_n_anchors) {
+		use_filter = true;
+		uint64_t n_slots = round_up_pow2(std::max<uint64_t>(2 * max_n_anchors, 64));
+		slots.assign(n_slots, empty_slot);
+		slots_mask = n_slots - 1;
+		slots_shift = 64;
+		for (uint64_t x = n_slots; x > 1; x >>= 1)
+			--slots_shift;
+
+		uint64_t n_bloom_bits = round_up_pow2(std::max<uint64_t>(bloom_bits_per_anchor * max_n_anchors, 64));
+		bloom.assign(n_bloom_bits / 64, 0);
+		bloom_mask = n_bloom_bits - 1;
+	}
 public:
 	//if anchors empty all anchors are accepted
 	AcceptedAnchors(const std::vector<uint64_t>& anchors) {
 		if (anchors.size() == 0)
 			return;
 
-		use_filter = true;
+		init(anchors.size());
 
 		for (auto anchor : anchors)
-			accepted_anchors.emplace(anchor);
+			insert(anchor);
+		make_sorted();
 	}
 	//if path == "" all anchors accepted
 	AcceptedAnchors(const std::string& path) {
 		if (path == "")
 			return;
 
-		use_filter = true;
-
 		std::ifstream in(path);
 		if (!in) {
 			std::cerr << "Error: cannot open file " << path << "\n";
 			exit(1);
 		}
+		std::vector<uint64_t> anchors;
 		std::string anchor;
 		while (in >> anchor)
-			accepted_anchors.insert(str_kmer_to_uint64_t(anchor));
+			anchors.push_back(str_kmer_to_uint64_t(anchor));
 
+		//empty file means that no anchor is accepted
+		init(anchors.size());
+		for (auto anchor : anchors)
+			insert(anchor);
+		make_sorted();
+	}
+	AcceptedAnchors() :
+		AcceptedAnchors(std::string("")) {
 	}
+
+	bool AcceptsAll() const {
+		return !use_filter;
+	}
+
+	uint64_t Size() const {
+		return n_anchors;
+	}
+
+	//sorted, unique
+	const std::vector<uint64_t>& GetAnchors() const {
+		return sorted_anchors;
+	}
+
+	//the smallest accepted anchor > anchor, false if there is no such one
+	bool GetNextAccepted(uint64_t anchor, uint64_t& next) const {
+		auto it = std::upper_bound(sorted_anchors.begin(), sorted_anchors.end(), anchor);
+		if (it == sorted_anchors.end())
+			return false;
+		next = *it;
+		return true;
+	}
+
 	bool IsAccepted(uint64_t anchor) const {
 		if (!use_filter)
 			return true;
-		return accepted_anchors.find(anchor) != accepted_anchors.end();
+
+		if (!bloom_contains(MurMur64Hash{}(anchor)))
+			return false;
+
+		if (anchor == empty_slot)
+			return contains_empty_slot_anchor;
+
+		auto pos = slot_pos(anchor);
+		while (slots[pos] != empty_slot) {
+			if (slots[pos] == anchor)
+				return true;
+			pos = (pos + 1) & slots_mask;
+		}
+		return false;
 	}
 };
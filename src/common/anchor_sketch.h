@@ -0,0 +1,154 @@
+#pragma once
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
+#include "murmur64.h"
+#include "../../libs/refresh/zstd_file.h"
+
+//count-min sketch of per anchor statistics used by satc_merge filters (total count, number of samples, number of unique targets)
+//each sample adds 1 to the number of samples and its own number of unique targets, so after merging sketches of all samples
+//all estimates are upper bounds of the values satc_merge will compute, so an anchor may be safely dropped in stage 1
+//if any estimate does not pass the corresponding threshold
+class AnchorSketch {
+	static const uint32_t magic = 0x4b535441; //"ATSK"
+	static const uint32_t version = 1;
+
+	enum field { tot_cnt, n_samples, n_targets, n_fields };
+
+	uint32_t depth{};
+	uint32_t width_log2{};
+	uint64_t width{};
+	std::unique_ptr<std::atomic<uint32_t>[]> cells; //[row][col][field]
+
+	uint64_t cell_idx(uint64_t anchor, uint32_t row) const {
+		uint64_t h = MurMur64Hash{}(anchor);
+		uint64_t h1 = h & 0xffffffffull;
+		uint64_t h2 = (h >> 32) | 1;
+		return ((row * width) + ((h1 + row * h2) & (width - 1))) * n_fields;
+	}
+
+	static uint32_t saturated_add(uint64_t a, uint64_t b) {
+		return static_cast<uint32_t>(std::min<uint64_t>(a + b, UINT32_MAX));
+	}
+
+	//saturates at UINT32_MAX instead of wrapping, so estimates stay upper bounds
+	static void saturated_fetch_add(std::atomic<uint32_t>& cell, uint64_t x) {
+		x = std::min<uint64_t>(x, UINT32_MAX);
+		uint32_t cur = cell.load(std::memory_order_relaxed);
+		while (cur != UINT32_MAX && !cell.compare_exchange_weak(cur, saturated_add(cur, x), std::memory_order_relaxed))
+			;
+	}
+
+	void allocate() {
+		uint64_t size = depth * width * n_fields;
+		cells.reset(new std::atomic<uint32_t>[size]);
+		for (uint64_t i = 0; i < size; ++i)
+			cells[i].store(0, std::memory_order_relaxed);
+	}
+public:
+	AnchorSketch() = default;
+
+	AnchorSketch(uint32_t depth, uint32_t width_log2) :
+		depth(depth),
+		width_log2(width_log2),
+		width(1ull << width_log2) {
+		allocate();
+	}
+
+	bool empty() const {
+		return !cells;
+	}
+
+	//may be called concurrently
+	void Add(uint64_t anchor, uint64_t tot_cnt, uint64_t n_unique_targets) {
+		for (uint32_t row = 0; row < depth; ++row) {
+			auto idx = cell_idx(anchor, row);
+			saturated_fetch_add(cells[idx + field::tot_cnt], tot_cnt);
+			saturated_fetch_add(cells[idx + field::n_samples], 1);
+			saturated_fetch_add(cells[idx + field::n_targets], n_unique_targets);
+		}
+	}
+
+	//true if the anchor would be filtered out by satc_merge anyway (the same semantics as anchor_filtered_out in satc_merge)
+	bool FilteredOut(uint64_t anchor, uint64_t anchor_count_threshold, uint64_t anchor_unique_targets_threshold, uint64_t anchor_samples_threshold) const {
+		uint64_t est[n_fields] = { UINT32_MAX, UINT32_MAX, UINT32_MAX };
+		for (uint32_t row = 0; row < depth; ++row) {
+			auto idx = cell_idx(anchor, row);
+			for (uint32_t f = 0; f < n_fields; ++f)
+				est[f] = std::min<uint64_t>(est[f], cells[idx + f].load(std::memory_order_relaxed));
+		}
+		return
+			est[field::tot_cnt] <= anchor_count_threshold ||
+			est[field::n_targets] <= anchor_unique_targets_threshold ||
+			est[field::n_samples] <= anchor_samples_threshold;
+	}
+
+	void Merge(const AnchorSketch& rhs) {
+		if (empty()) {
+			depth = rhs.depth;
+			width_log2 = rhs.width_log2;
+			width = rhs.width;
+			allocate();
+		}
+		if (depth != rhs.depth || width_log2 != rhs.width_log2) {
+			std::cerr << "Error: cannot merge sketches of different sizes\n";
+			exit(1);
+		}
+		uint64_t size = depth * width * n_fields;
+		for (uint64_t i = 0; i < size; ++i)
+			cells[i].store(saturated_add(cells[i].load(std::memory_order_relaxed), rhs.cells[i].load(std::memory_order_relaxed)), std::memory_order_relaxed);
+	}
+
+	bool Save(const std::string& path) const {
+		refresh::zstd_file out(3);
+		if (!out.open_writing(path))
+			return false;
+
+		uint32_t hdr[] = { magic, version, depth, width_log2 };
+		out.write(reinterpret_cast<char*>(hdr), sizeof(hdr));
+
+		std::vector<uint32_t> buf;
+		const uint64_t size = depth * width * n_fields;
+		const uint64_t chunk = 1ull << 20;
+		for (uint64_t i = 0; i < size; i += chunk) {
+			buf.clear();
+			for (uint64_t j = i; j < std::min(size, i + chunk); ++j)
+				buf.push_back(cells[j].load(std::memory_order_relaxed));
+			out.write(reinterpret_cast<char*>(buf.data()), buf.size() * sizeof(uint32_t));
+		}
+		out.close();
+		return true;
+	}
+
+	bool Load(const std::string& path) {
+		refresh::zstd_file in;
+		if (!in.open_reading(path))
+			return false;
+
+		uint32_t hdr[4];
+		if (in.read(reinterpret_cast<char*>(hdr), sizeof(hdr)) != sizeof(hdr) || hdr[0] != magic || hdr[1] > version)
+			return false;
+
+		depth = hdr[2];
+		width_log2 = hdr[3];
+		width = 1ull << width_log2;
+		allocate();
+
+		std::vector<uint32_t> buf;
+		const uint64_t size = depth * width * n_fields;
+		const uint64_t chunk = 1ull << 20;
+		for (uint64_t i = 0; i < size; i += chunk) {
+			buf.resize(std::min(size - i, chunk));
+			auto to_read = buf.size() * sizeof(uint32_t);
+			if (in.read(reinterpret_cast<char*>(buf.data()), to_read) != to_read)
+				return false;
+			for (uint64_t j = 0; j < buf.size(); ++j)
+				cells[i + j].store(buf[j], std::memory_order_relaxed);
+		}
+		return true;
+	}
+};
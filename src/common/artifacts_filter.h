@@ -2,11 +2,59 @@
 #define _ARTIFACTS_FILTER_H
 #include "../common/satc_data.h"
 #include <unordered_set>
-#include <map>
+#include <vector>
+#include <algorithm>
 
 class ArtifactsFilter
 {
-	std::map<uint32_t, std::unordered_set<uint64_t>> artifacts; //index is artifact len
+	//artifacts of length up to this are stored in direct-address bitset (4^len bits, 8MB for 13)
+	static const uint32_t max_direct_len = 13;
+
+	//longer artifacts are first checked in a bitset of fingerprints, exact set is probed only on a hit
+	static const uint32_t fingerprint_bits = 22;
+
+	struct ArtifactsOfLen {
+		uint32_t len;
+		uint64_t mask;
+		std::vector<uint64_t> bits;
+		std::unordered_set<uint64_t> exact; //only for len > max_direct_len
+
+		ArtifactsOfLen(uint32_t len) :
+			len(len),
+			mask(((1ull << len) << len) - 1), //I shift twice because len may be 32...
+			bits(len <= max_direct_len ? ((1ull << (2 * len)) + 63) / 64 : (1ull << fingerprint_bits) / 64) {
+		}
+
+		uint64_t bit_pos(uint64_t x) const {
+			if (len <= max_direct_len)
+				return x;
+			return (x * 0x9E3779B97F4A7C15ull) >> (64 - fingerprint_bits);
+		}
+
+		void insert(uint64_t x) {
+			x &= mask;
+			auto pos = bit_pos(x);
+			bits[pos / 64] |= 1ull << (pos % 64);
+			if (len > max_direct_len)
+				exact.insert(x);
+		}
+
+		bool contains(uint64_t x) const {
+			auto pos = bit_pos(x);
+			if (!(bits[pos / 64] & (1ull << (pos % 64))))
+				return false;
+			return len <= max_direct_len || exact.count(x);
+		}
+	};
+
+	std::vector<ArtifactsOfLen> artifacts; //sorted by artifact len
+
+	ArtifactsOfLen& get_artifacts_of_len(uint32_t len) {
+		auto it = std::lower_bound(artifacts.begin(), artifacts.end(), len, [](const ArtifactsOfLen& x, uint32_t len) {return x.len < len; });
+		if (it == artifacts.end() || it->len != len)
+			it = artifacts.emplace(it, len);
+		return *it;
+	}
 public:
 	ArtifactsFilter(const std::string& path) //empty path means no filtering
 	{
@@ -14,7 +62,7 @@ public:
 			return;
 
 		std::ifstream in(path);
-		
+
 		if (!in)
 		{
 			std::cerr << "Error: cannot open file " << path << "\n";
@@ -26,7 +74,7 @@ public:
 		{
 			auto len = artifact.length();
 			assert(len <= 32);
-			artifacts[len].insert(str_kmer_to_uint64_t(artifact));
+			get_artifacts_of_len(len).insert(str_kmer_to_uint64_t(artifact));
 		}
 	}
 	ArtifactsFilter() :
@@ -36,40 +84,31 @@ public:
 	}
 
 	void Add(uint32_t len, const std::vector<uint64_t>& new_artifacts) {
-		auto& art = artifacts[len];
+		auto& art = get_artifacts_of_len(len);
 		for (auto x : new_artifacts)
 			art.insert(x);
 	}
 
 	bool ContainsArtifact(uint64_t anchor, uint32_t len) const
 	{
-		for (const auto& x : artifacts)
+		for (const auto& art : artifacts)
 		{
-			uint32_t art_len = x.first;
-
-			//skip too long artifacts
-			if (art_len > len)
-				continue;
-
-			const auto& art = x.second;
-			
-			uint64_t mask = ((1ull) << (2 * art_len)) - 1;
+			//artifacts are sorted by len, so all remaining are too long
+			if (art.len > len)
+				break;
 
-			auto no_parts = len - art_len + 1;
+			auto no_parts = len - art.len + 1;
 			uint64_t check = anchor;
-			for (uint32_t i = 0; i < no_parts - 1; ++i)
+			for (uint32_t i = 0; i < no_parts; ++i)
 			{
-				if (art.count(check & mask))
+				if (art.contains(check & art.mask))
 					return true;
 				check >>= 2;
 			}
-			//last one
-			if (art.count(check & mask))
-				return true;
 		}
 		return false;
 	}
 };
 
 
-#endif 
+#endif
@@ -0,0 +1,238 @@
+#pragma once
+#include <cstdio>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+
+//all bins of a sample stored one after another in a single file (instead of n_bins files)
+//each bin is a complete SATC file, offsets inside of it (e.g. of the index) are relative to the bin start
+//footer (not compressed): n_bins * (offset, size), n_bins, magic (all 8 bytes little endian)
+//a bin inside a container is addressed as <container path>:<bin id>, container path must end with .bins
+struct BinContainerFooter {
+	static constexpr uint64_t magic = 0x314E494243544153ull; //"SATCBIN1"
+	static constexpr uint64_t tail_size = 2 * sizeof(uint64_t);
+	static constexpr const char* ext = ".bins";
+};
+
+inline int bin_container_fseek(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(f, static_cast<int64_t>(offset), SEEK_SET);
+#else
+	return fseeko(f, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+
+inline bool bin_container_read_u64s(FILE* f, uint64_t offset, std::vector<uint64_t>& res, size_t n) {
+	res.assign(n, 0);
+	std::vector<uint8_t> raw(n * sizeof(uint64_t));
+	if (bin_container_fseek(f, offset) || fread(raw.data(), 1, raw.size(), f) != raw.size())
+		return false;
+	for (size_t i = 0; i < n; ++i)
+		for (uint32_t b = 0; b < sizeof(uint64_t); ++b)
+			res[i] += (uint64_t)raw[i * sizeof(uint64_t) + b] << (8 * b);
+	return true;
+}
+
+//false if path does not point to a bin inside a container
+inline bool split_bin_container_path(const std::string& path, std::string& container_path, uint64_t& bin_id) {
+	auto pos = path.find_last_of(':');
+	if (pos == std::string::npos || pos + 1 == path.size())
+		return false;
+	if (path.find_first_not_of("0123456789", pos + 1) != std::string::npos)
+		return false;
+	std::string ext(BinContainerFooter::ext);
+	if (pos < ext.size() || path.compare(pos - ext.size(), ext.size(), ext) != 0)
+		return false;
+	container_path = path.substr(0, pos);
+	bin_id = std::stoull(path.substr(pos + 1));
+	return true;
+}
+
+inline std::string bin_container_path(const std::string& out_base) {
+	return out_base + BinContainerFooter::ext;
+}
+
+//physical file of path and the range of the (possibly contained) bin in it, exits on error
+//true if the bin is in a container
+inline bool locate_bin(const std::string& path, std::string& file_path, uint64_t& offset, uint64_t& size) {
+	uint64_t bin_id;
+	if (!split_bin_container_path(path, file_path, bin_id)) {
+		file_path = path;
+		offset = 0;
+		FILE* f = fopen(path.c_str(), "rb");
+		if (!f) {
+			std::cerr << "Error: cannot open file " << path << " to get file size\n";
+			exit(1);
+		}
+		fseek(f, 0, SEEK_END);
+#ifdef _WIN32
+		size = static_cast<uint64_t>(_ftelli64(f));
+#else
+		size = static_cast<uint64_t>(ftello(f));
+#endif
+		fclose(f);
+		return false;
+	}
+
+	FILE* f = fopen(file_path.c_str(), "rb");
+	if (!f) {
+		std::cerr << "Error: cannot open file " << file_path << "\n";
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+#ifdef _WIN32
+	uint64_t file_size = static_cast<uint64_t>(_ftelli64(f));
+#else
+	uint64_t file_size = static_cast<uint64_t>(ftello(f));
+#endif
+	std::vector<uint64_t> tail, entry;
+	if (file_size < BinContainerFooter::tail_size || !bin_container_read_u64s(f, file_size - BinContainerFooter::tail_size, tail, 2) || tail[1] != BinContainerFooter::magic) {
+		std::cerr << "Error: " << file_path << " is not a bins container\n";
+		exit(1);
+	}
+	if (bin_id >= tail[0]) {
+		std::cerr << "Error: there is no bin " << bin_id << " in " << file_path << " (n_bins: " << tail[0] << ")\n";
+		exit(1);
+	}
+	uint64_t entries_start = file_size - BinContainerFooter::tail_size - tail[0] * 2 * sizeof(uint64_t);
+	if (!bin_container_read_u64s(f, entries_start + bin_id * 2 * sizeof(uint64_t), entry, 2) || entry[0] + entry[1] > entries_start) {
+		std::cerr << "Error: corrupted footer of " << file_path << "\n";
+		exit(1);
+	}
+	fclose(f);
+	offset = entry[0];
+	size = entry[1];
+	return true;
+}
+
+//writes bins of a sample to a container, bins are written in parallel (each by a single writer) and stored in bin id order
+//each bin is buffered in memory, when its buffer exceeds spill_threshold it is moved to a spill file shared by all bins (<container path>.spill),
+//so memory is bounded by about n_bins * spill_threshold also for deep samples and the spill file is created only for them
+class BinContainerWriter {
+	struct Chunk {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	std::string path;
+	size_t spill_threshold;
+	std::vector<std::vector<uint8_t>> buffers;
+	std::vector<std::vector<Chunk>> spilled_chunks;
+	std::vector<uint64_t> spilled_size;
+
+	FILE* spill{};
+	uint64_t spill_size{};
+	std::mutex spill_mtx;
+
+	std::string spill_path() const {
+		return path + ".spill";
+	}
+
+	void remove_spill() {
+		if (!spill)
+			return;
+		fclose(spill);
+		spill = nullptr;
+		remove(spill_path().c_str());
+	}
+
+	bool copy_spilled(FILE* out, const Chunk& chunk, std::vector<uint8_t>& buf) {
+		if (bin_container_fseek(spill, chunk.offset))
+			return false;
+		for (uint64_t done = 0; done < chunk.size; ) {
+			size_t n = static_cast<size_t>(std::min<uint64_t>(buf.size(), chunk.size - done));
+			if (fread(buf.data(), 1, n, spill) != n || fwrite(buf.data(), 1, n, out) != n)
+				return false;
+			done += n;
+		}
+		return true;
+	}
+public:
+	explicit BinContainerWriter(size_t spill_threshold = 1ull << 20) :
+		spill_threshold(spill_threshold) {
+	}
+
+	BinContainerWriter(const BinContainerWriter&) = delete;
+	BinContainerWriter& operator=(const BinContainerWriter&) = delete;
+
+	~BinContainerWriter() {
+		remove_spill();
+	}
+
+	//buffers are reused between containers
+	void open(const std::string& path, uint32_t n_bins) {
+		this->path = path;
+		buffers.resize(n_bins);
+		for (auto& buf : buffers)
+			buf.clear();
+		spilled_chunks.assign(n_bins, {});
+		spilled_size.assign(n_bins, 0);
+		spill_size = 0;
+	}
+
+	//data of a bin is appended to it, then spill_if_needed should be called
+	std::vector<uint8_t>& buffer(uint32_t bin_id) {
+		return buffers[bin_id];
+	}
+
+	//size of a bin written so far
+	uint64_t tell(uint32_t bin_id) const {
+		return spilled_size[bin_id] + buffers[bin_id].size();
+	}
+
+	void spill_if_needed(uint32_t bin_id) {
+		auto& buf = buffers[bin_id];
+		if (buf.size() < spill_threshold)
+			return;
+		std::lock_guard<std::mutex> lck(spill_mtx);
+		if (!spill) {
+			spill = fopen(spill_path().c_str(), "w+b");
+			if (!spill) {
+				std::cerr << "Error: cannot open file " << spill_path() << "\n";
+				exit(1);
+			}
+		}
+		if (bin_container_fseek(spill, spill_size) || fwrite(buf.data(), 1, buf.size(), spill) != buf.size()) {
+			std::cerr << "Error: cannot write to file " << spill_path() << "\n";
+			exit(1);
+		}
+		spilled_chunks[bin_id].push_back({ spill_size, buf.size() });
+		spill_size += buf.size();
+		spilled_size[bin_id] += buf.size();
+		buf.clear();
+	}
+
+	//writers of all bins must be closed, the spill file is removed
+	bool close() {
+		FILE* out = fopen(path.c_str(), "wb");
+		if (!out) {
+			remove_spill();
+			return false;
+		}
+		bool ok = true;
+		std::vector<uint8_t> copy_buf(spill ? 1ull << 20 : 0);
+		std::vector<uint64_t> footer;
+		uint64_t offset{};
+		for (uint32_t bin_id = 0; bin_id < buffers.size(); ++bin_id) {
+			for (const auto& chunk : spilled_chunks[bin_id])
+				ok = ok && copy_spilled(out, chunk, copy_buf);
+			ok = ok && fwrite(buffers[bin_id].data(), 1, buffers[bin_id].size(), out) == buffers[bin_id].size();
+			footer.push_back(offset);
+			footer.push_back(tell(bin_id));
+			offset += tell(bin_id);
+		}
+		footer.push_back(buffers.size());
+		footer.push_back(BinContainerFooter::magic);
+		remove_spill();
+
+		std::vector<uint8_t> raw;
+		for (auto x : footer)
+			for (uint32_t b = 0; b < sizeof(x); ++b)
+				raw.push_back(static_cast<uint8_t>(x >> (8 * b)));
+		ok = ok && fwrite(raw.data(), 1, raw.size(), out) == raw.size();
+		return fclose(out) == 0 && ok;
+	}
+};
@@ -1,5 +1,7 @@
 #pragma once
 #include <iostream>
+#include <string>
+#include <cstdlib>
 enum class input_format_t { fasta, fastq, bam, cram };
 
 inline input_format_t input_format_from_string(const std::string& str) {
@@ -7,8 +9,10 @@ inline input_format_t input_format_from_string(const std::string& str) {
 		return input_format_t::fasta;
 	else if (str == "fq" || str == "fastq" || str == "FASTQ")
 		return input_format_t::fastq;
-	else
+	else {
 		std::cerr << "Unknown input format: " << str << std::endl;
+		exit(1);
+	}
 }
 
 inline std::string to_string(input_format_t input_format) {
@@ -21,5 +25,8 @@ inline std::string to_string(input_format_t input_format) {
 			return "bam";
 		case input_format_t::cram:
 			return "cram";
+		default:
+			std::cerr << "Error: unknown input format, please contact authors showing this message: " << __FILE__ << ":" << __LINE__ << "\n";
+			exit(1);
 	}
 }
\ No newline at end of file
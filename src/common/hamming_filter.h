@@ -2,6 +2,7 @@
 #define _HAMMING_FILTER_H
 #include <cinttypes>
 #include <vector>
+#include <algorithm>
 #include "target_count.h"
 
 class HammingFilter
@@ -31,6 +32,88 @@ class HammingFilter
 		return cnt;
 	}
 
+    //for small number of targets simple check of all pairs is the fastest
+    static const size_t max_targets_for_all_pairs = 32;
+
+    bool contains_distant_pair_all_pairs(const std::vector<TargetCount>& targets) const
+    {
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            for (size_t j = i+1; j < targets.size(); ++j)
+            {
+                uint64_t target_i = targets[i].target;
+                uint64_t target_j = targets[j].target;
+                if (static_cast<uint32_t>(hamming_dist(target_i, target_j)) >= min_hamming_threshold)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    //hamming distance is a metric, so d(x, y) <= d(x, p) + d(p, y) for any pivot p
+    //distances to two pivots are computed in O(T), if any of them is large enough we are done,
+    //otherwise only pairs for which both upper bounds reach the threshold are compared
+    //for anchors with many similar targets (the costly case) most pairs are skipped
+    bool contains_distant_pair_pivots(const std::vector<TargetCount>& targets) const
+    {
+        struct TargetDists {
+            uint64_t target;
+            uint32_t dist_p;
+            uint32_t dist_q;
+        };
+
+        std::vector<TargetDists> dists;
+        dists.reserve(targets.size());
+
+        uint64_t p = targets[0].target;
+        uint64_t q = p;
+        uint32_t max_dist_p = 0;
+        for (const auto& x : targets)
+        {
+            uint32_t d = hamming_dist(p, x.target);
+            if (d >= min_hamming_threshold)
+                return true;
+            if (d > max_dist_p)
+            {
+                max_dist_p = d;
+                q = x.target;
+            }
+            dists.push_back({ x.target, d, 0 });
+        }
+
+        //all targets are equal
+        if (max_dist_p == 0)
+            return false;
+
+        //second pivot is the farthest from the first one
+        for (auto& x : dists)
+        {
+            x.dist_q = hamming_dist(q, x.target);
+            if (x.dist_q >= min_hamming_threshold)
+                return true;
+        }
+
+        std::sort(dists.begin(), dists.end(), [](const TargetDists& a, const TargetDists& b) {return a.dist_p > b.dist_p; });
+
+        for (size_t i = 0; i + 1 < dists.size(); ++i)
+        {
+            if (dists[i].dist_p + dists[i + 1].dist_p < min_hamming_threshold)
+                break;
+            for (size_t j = i + 1; j < dists.size(); ++j)
+            {
+                if (dists[i].dist_p + dists[j].dist_p < min_hamming_threshold)
+                    break;
+                if (dists[i].dist_q + dists[j].dist_q < min_hamming_threshold)
+                    continue;
+                if (static_cast<uint32_t>(hamming_dist(dists[i].target, dists[j].target)) >= min_hamming_threshold)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
 public:
     HammingFilter(uint32_t min_hamming_threshold)
         : min_hamming_threshold(min_hamming_threshold)
@@ -51,18 +134,10 @@ public:
         if (targets.size() < 2)
             return false;
 
-        for (size_t i = 0; i < targets.size(); ++i)
-        {
-            for (size_t j = i+1; j < targets.size(); ++j)
-            {
-                uint64_t target_i = targets[i].target;
-                uint64_t target_j = targets[j].target;
-                if (static_cast<uint32_t>(hamming_dist(target_i, target_j)) >= min_hamming_threshold)
-                    return true;
-            }
-        }
+        if (targets.size() <= max_targets_for_all_pairs)
+            return contains_distant_pair_all_pairs(targets);
 
-        return false;
+        return contains_distant_pair_pivots(targets);
     }
 };
 #endif
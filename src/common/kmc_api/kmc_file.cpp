@@ -95,7 +95,107 @@ bool CKMCFile::OpenForListing(const std::string &file_name)
 	is_opened = opened_for_listing;
 	prefix_index = 0;
 	sufix_number = 0;
+	listing_begin_sufix_number = 0;
+	listing_end_sufix_number = total_kmers;
 	index_in_partial_buf = 0;
+	db_file_name = file_name;
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Open files *kmc_pre & *.kmc_suf for listing only k-mers with prefixes in [prefix_begin, prefix_end)
+// Only KMC1 format is supported. Many objects may list disjoint ranges of the same database in parallel
+// IN	: file_name - the name of kmer_counter's output
+// IN	: prefix_begin, prefix_end - range of prefixes (in LUT) to be listed
+// RET	: true		- if successful
+//----------------------------------------------------------------------------------
+bool CKMCFile::OpenForListingRange(const std::string& file_name, uint64 prefix_begin, uint64 prefix_end)
+{
+	uint64 size;
+
+	if (is_opened)
+		return false;
+
+	if (file_pre || file_suf)
+		return false;
+
+	if (!OpenASingleFile(file_name + ".kmc_pre", file_pre, size, (char*)"KMCP"))
+		return false;
+
+	if (!ReadParamsFrom_prefix_file_buf(size, open_mode::opened_for_listing))
+		return false;
+
+	uint64 lut_size = 1ull << (2 * lut_prefix_length);
+	if (kmc_version != 0 || prefix_begin > prefix_end || prefix_end > lut_size)
+		return false;
+
+	auto read_lut_entry = [&](uint64 prefix) -> uint64 {
+		if (prefix == lut_size) //guard
+			return total_kmers;
+		uint64 res;
+		my_fseek(file_pre, 4 + 8 * prefix, SEEK_SET);
+		if (fread(&res, sizeof(uint64), 1, file_pre) != 1)
+			return total_kmers;
+		return res;
+	};
+
+	listing_begin_sufix_number = read_lut_entry(prefix_begin);
+	listing_end_sufix_number = read_lut_entry(prefix_end);
+
+	prefixFileBufferForListingMode = std::make_unique<CPrefixFileBufferForListingMode>(file_pre, lut_size, lut_prefix_length, true, total_kmers, prefix_begin);
+
+	end_of_file = listing_begin_sufix_number == listing_end_sufix_number;
+
+	if (!OpenASingleFile(file_name + ".kmc_suf", file_suf, size, (char*)"KMCS"))
+		return false;
+
+	my_fseek(file_suf, 4 + listing_begin_sufix_number * sufix_rec_size, SEEK_SET);
+
+	sufix_file_buf = new uchar[part_size];
+
+	suffix_file_total_to_read = (listing_end_sufix_number - listing_begin_sufix_number) * sufix_rec_size;
+	suf_file_left_to_read = suffix_file_total_to_read;
+	auto to_read = MIN(suf_file_left_to_read, part_size);
+	auto readed = fread(sufix_file_buf, 1, to_read, file_suf);
+	if (readed != to_read)
+	{
+		std::cerr << "Error: some error while reading suffix file\n";
+		return false;
+	}
+
+	suf_file_left_to_read -= readed;
+
+	is_opened = opened_for_listing;
+	prefix_index = 0;
+	sufix_number = listing_begin_sufix_number;
+	index_in_partial_buf = 0;
+	db_file_name = file_name;
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Read the whole LUT of a KMC1 database opened for listing
+// OUT	: lut - lut[p] is the number of the first suffix of prefix p, the last element is the total number of k-mers
+// RET	: true		- if successful
+//----------------------------------------------------------------------------------
+bool CKMCFile::ReadLUT(std::vector<uint64>& lut)
+{
+	if (is_opened != opened_for_listing || kmc_version != 0)
+		return false;
+
+	FILE* file = my_fopen((db_file_name + ".kmc_pre").c_str(), "rb");
+	if (!file)
+		return false;
+
+	uint64 lut_size = 1ull << (2 * lut_prefix_length);
+	lut.resize(lut_size + 1);
+	my_fseek(file, 4, SEEK_SET);
+	auto readed = fread(lut.data(), sizeof(uint64), lut_size, file);
+	fclose(file);
+	if (readed != lut_size)
+		return false;
+
+	lut[lut_size] = total_kmers;
 	return true;
 }
 //----------------------------------------------------------------------------------
@@ -490,7 +590,7 @@ bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint32 &count)
 		}
 		sufix_number++;
 	
-		if(sufix_number == total_kmers)
+		if(sufix_number == listing_end_sufix_number)
 			end_of_file = true;
 	}
 	while ((counter_size != 0) && ((count < min_count) || (count > max_count))); //do not applay filtering if counter_size == 0 as it does not make sense
@@ -569,7 +669,7 @@ bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint64 &count)
 		}
 		sufix_number++;
 
-		if (sufix_number == total_kmers)
+		if (sufix_number == listing_end_sufix_number)
 			end_of_file = true;
 
 	} while ((counter_size != 0) && ((count < min_count) || (count > max_count))); //do not applay filtering if counter_size == 0 as it does not make sense
@@ -577,6 +677,109 @@ bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint64 &count)
 	return true;
 }
 
+//-----------------------------------------------------------------------------------------------
+// Read many k-mers at once. Whole records are decoded directly from the suffix buffer
+// into packed words, without CKmerAPI objects. Only for k <= 64
+// OUT: kmers - space for max_kmers * KmerWords() words, each k-mer is right aligned,
+//              most significant word first (2 bits per symbol, the first symbol is the most significant)
+// OUT: counters - space for max_kmers counters
+// RET: number of k-mers read, 0 means EOF
+//-----------------------------------------------------------------------------------------------
+uint64 CKMCFile::ReadNextKmersBulk(uint64* kmers, uint64* counters, uint64 max_kmers)
+{
+	if (is_opened != opened_for_listing || kmer_length > 64)
+		return 0;
+
+	const uint32 n_words = KmerWords();
+	const uint32 suf_bits = 8 * sufix_size;
+
+	uint64 n_read = 0;
+	while (n_read < max_kmers && !end_of_file)
+	{
+		if (index_in_partial_buf == part_size)
+			Reload_sufix_file_buf();
+
+		//number of records that may be decoded without checking buffer boundaries
+		uint64 n_in_buf = (part_size - index_in_partial_buf) / sufix_rec_size;
+		n_in_buf = MIN(n_in_buf, listing_end_sufix_number - sufix_number);
+
+		if (n_in_buf == 0) //record spans two buffers
+		{
+			uchar rec[64];
+			for (uint32 i = 0; i < sufix_rec_size; ++i)
+			{
+				if (index_in_partial_buf == part_size)
+					Reload_sufix_file_buf();
+				rec[i] = sufix_file_buf[index_in_partial_buf++];
+			}
+			n_read += decode_sufix_records(rec, 1, kmers + n_read * n_words, counters + n_read, n_words, suf_bits);
+			continue;
+		}
+
+		uint64 n_to_decode = MIN(n_in_buf, max_kmers - n_read);
+		const uchar* rec = sufix_file_buf + index_in_partial_buf;
+		index_in_partial_buf += n_to_decode * sufix_rec_size;
+		n_read += decode_sufix_records(rec, n_to_decode, kmers + n_read * n_words, counters + n_read, n_words, suf_bits);
+	}
+	return n_read;
+}
+
+//-----------------------------------------------------------------------------------------------
+// Decode n_recs consecutive records (suffix + counter) of the suffix file. Auxiliary function.
+// RET: number of k-mers stored (k-mers with counters out of [min_count, max_count] are skipped)
+//-----------------------------------------------------------------------------------------------
+uint64 CKMCFile::decode_sufix_records(const uchar* rec, uint64 n_recs, uint64* kmers, uint64* counters, uint32 n_words, uint32 suf_bits)
+{
+	uint64 n_stored = 0;
+	for (uint64 r = 0; r < n_recs; ++r, rec += sufix_rec_size)
+	{
+		uint64 prefix = prefixFileBufferForListingMode->GetPrefix(sufix_number);
+		++sufix_number;
+		if (sufix_number == listing_end_sufix_number)
+			end_of_file = true;
+
+		uint64 count = 1;
+		if (counter_size != 0)
+		{
+			count = 0;
+			for (uint32 b = 0; b < counter_size; ++b)
+				count |= (uint64)rec[sufix_size + b] << (8 * b);
+			if (count < min_count || count > max_count)
+				continue;
+		}
+		counters[n_stored] = count;
+
+		if (n_words == 1)
+		{
+			uint64 kmer = prefix;
+			for (uint32 a = 0; a < sufix_size; ++a)
+				kmer = (kmer << 8) | rec[a];
+			kmers[n_stored] = kmer;
+		}
+		else
+		{
+			uint64 hi = 0, lo = 0;
+			for (uint32 a = 0; a < sufix_size; ++a)
+			{
+				hi = (hi << 8) | (lo >> 56);
+				lo = (lo << 8) | rec[a];
+			}
+			if (suf_bits >= 64)
+				hi |= prefix << (suf_bits - 64);
+			else
+			{
+				lo |= prefix << suf_bits;
+				if (suf_bits)
+					hi |= prefix >> (64 - suf_bits);
+			}
+			kmers[2 * n_stored] = hi;
+			kmers[2 * n_stored + 1] = lo;
+		}
+		++n_stored;
+	}
+	return n_stored;
+}
+
 //-------------------------------------------------------------------------------
 // Reload a contents of an array "sufix_file_buf" for listing mode. Auxiliary function.
 //-------------------------------------------------------------------------------
@@ -632,7 +835,7 @@ bool CKMCFile::Close()
 //----------------------------------------------------------------------------------
 bool CKMCFile::RestartListing(void)
 {
-	if(is_opened == opened_for_listing)
+	if(is_opened == opened_for_listing && listing_begin_sufix_number == 0 && listing_end_sufix_number == total_kmers)
 	{
 		my_fseek(file_suf , 4 , SEEK_SET);
 		suf_file_left_to_read = suffix_file_total_to_read;
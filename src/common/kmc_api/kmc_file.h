@@ -61,16 +61,18 @@ class CKMCFile
 			posInBuf = 0;
 		}
 	public:
-		CPrefixFileBufferForListingMode(FILE* file, uint64_t wholeLutSize, uint64_t lutPrefixLen, bool isKMC1, uint64_t totalKmers)
+		//firstPrefix != 0 is valid only for KMC1 (listing of a range of prefixes)
+		CPrefixFileBufferForListingMode(FILE* file, uint64_t wholeLutSize, uint64_t lutPrefixLen, bool isKMC1, uint64_t totalKmers, uint64_t firstPrefix = 0)
 			:
 			buff(new uint64_t[buffCapacity]),
-			leftToRead(wholeLutSize),
+			buffPosInFile(firstPrefix),
+			leftToRead(wholeLutSize - firstPrefix),
 			prefixMask((1ull << (2 * lutPrefixLen)) - 1),
 			file(file),
 			isKMC1(isKMC1),
 			totalKmers(totalKmers)
 		{
-			my_fseek(file, 4 + 8, SEEK_SET); //	skip KMCP and LUT[0] (always = 0)
+			my_fseek(file, 4 + 8 + 8 * firstPrefix, SEEK_SET); //	skip KMCP and LUT[0..firstPrefix]
 		}
 
 		//no control if next prefix exists here, responsibility to the caller
@@ -99,6 +101,9 @@ protected:
 	open_mode is_opened;
 	uint64 suf_file_left_to_read = 0; // number of bytes that are yet to read in a listing mode
 	uint64 suffix_file_total_to_read = 0; // number of bytes that constitutes records in kmc_suf file
+	uint64 listing_begin_sufix_number = 0; // the first suffix to be listed (!= 0 only for listing a range of prefixes)
+	uint64 listing_end_sufix_number = 0; // listing stops at this suffix
+	std::string db_file_name;
 	bool end_of_file;
 
 	FILE *file_pre;
@@ -148,6 +153,9 @@ protected:
 	// Reload a contents of an array "sufix_file_buf" for listing mode. Auxiliary function. 
 	void Reload_sufix_file_buf();
 
+	// Decode consecutive records of the suffix file into packed k-mers. Auxiliary function.
+	uint64 decode_sufix_records(const uchar* rec, uint64 n_recs, uint64* kmers, uint64* counters, uint32 n_words, uint32 suf_bits);
+
 	// Implementation of GetCountersForRead for kmc1 database format for both strands
 	bool GetCountersForRead_kmc1_both_strands(const std::string& read, std::vector<uint32>& counters);
 
@@ -173,6 +181,12 @@ public:
 	// Open files *kmc_pre & *.kmc_suf, read *.kmc_pre to RAM, *.kmc_suf is buffered
 	bool OpenForListing(const std::string& file_name);
 
+	// Open for listing only k-mers with prefixes (first lut_prefix_length symbols) in [prefix_begin, prefix_end). Only for KMC1 format
+	bool OpenForListingRange(const std::string& file_name, uint64 prefix_begin, uint64 prefix_end);
+
+	// Read the whole LUT of an opened KMC1 database, lut[p] is the number of the first suffix of prefix p, lut.back() is the total number of k-mers
+	bool ReadLUT(std::vector<uint64>& lut);
+
 	// Return true if kmc is in KMC2 compatiblie format
 	bool IsKMC2() const noexcept { return kmc_version == 0x200; }
 
@@ -180,6 +194,12 @@ public:
 	bool ReadNextKmer(CKmerAPI &kmer, uint64 &count); //for small k-values when counter may be longer than 4bytes
 	
 	bool ReadNextKmer(CKmerAPI &kmer, uint32 &count);
+
+	// Number of uint64 words used by ReadNextKmersBulk for a single k-mer (1 for k <= 32, 2 for k <= 64)
+	uint32 KmerWords() const noexcept { return kmer_length <= 32 ? 1 : 2; }
+
+	// Read up to max_kmers next k-mers packed into KmerWords() words each (right aligned, most significant word first). Return the number of k-mers read, 0 means EOF. Only for k <= 64
+	uint64 ReadNextKmersBulk(uint64* kmers, uint64* counters, uint64 max_kmers);
 	// Release memory and close files in case they were opened 
 	bool Close();
 
@@ -0,0 +1,75 @@
+#ifndef _LOSER_TREE_H
+#define _LOSER_TREE_H
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+//tournament tree for k-way merge, each internal node keeps the loser of the match played in it
+//the winner (leaf with the smallest key, on ties the smaller leaf id) is known in O(1)
+//after the key of the winner is changed (or the winner is deactivated) the tree is replayed in O(log k)
+//inactive leaves (e.g. exhausted inputs) lose with all active ones
+template<typename T>
+class LoserTree {
+	std::vector<T> keys;
+	std::vector<bool> active;
+	std::vector<size_t> tree; //tree[0]: winner, tree[1..n-1]: losers, leaf i is the node n + i
+
+	bool wins(size_t a, size_t b) const {
+		if (active[a] != active[b])
+			return active[a];
+		if (!active[a])
+			return a < b;
+		return keys[a] < keys[b] || (!(keys[b] < keys[a]) && a < b);
+	}
+
+	void replay(size_t leaf) {
+		size_t winner = leaf;
+		for (size_t node = (keys.size() + leaf) / 2; node > 0; node /= 2)
+			if (wins(tree[node], winner))
+				std::swap(tree[node], winner);
+		tree[0] = winner;
+	}
+public:
+	LoserTree(std::vector<T>&& keys, std::vector<bool>&& active) :
+		keys(std::move(keys)),
+		active(std::move(active)),
+		tree(this->keys.size() ? this->keys.size() : 1) {
+		//winners of subtrees, leaves are at n..2n-1
+		size_t n = this->keys.size();
+		std::vector<size_t> winners(2 * n);
+		for (size_t i = 0; i < n; ++i)
+			winners[n + i] = i;
+		for (size_t node = n - 1; node > 0 && n > 1; --node) {
+			size_t l = winners[2 * node], r = winners[2 * node + 1];
+			winners[node] = wins(l, r) ? l : r;
+			tree[node] = wins(l, r) ? r : l;
+		}
+		tree[0] = n > 1 ? winners[1] : 0;
+	}
+
+	bool Empty() const {
+		return keys.empty() || !active[tree[0]];
+	}
+
+	size_t Winner() const {
+		return tree[0];
+	}
+
+	const T& WinnerKey() const {
+		return keys[tree[0]];
+	}
+
+	//only the winner may be changed
+	void UpdateWinner(const T& key) {
+		keys[tree[0]] = key;
+		replay(tree[0]);
+	}
+
+	void DeactivateWinner() {
+		active[tree[0]] = false;
+		replay(tree[0]);
+	}
+};
+
+#endif // !_LOSER_TREE_H
@@ -6,8 +6,13 @@
 #include <algorithm>
 #include <cassert>
 #include <unordered_map>
+#include <thread>
+#include <future>
+#include <functional>
 
-#include "../../libs/refresh/zstd_file.h"
+#include "../../libs/refresh/parallel-queues.h"
+#include "temp_codec.h"
+#include "text_writer.h"
 
 #ifdef _WIN32
 #define _bswap64(x) _byteswap_uint64(x)
@@ -15,8 +20,6 @@
 #define _bswap64(x) __builtin_bswap64(x)
 #endif
 
-#define USE_ZSTD_FOR_TEMPS
-
 template<typename T>
 void append_int_msb(std::vector<uint8_t>& v, T x, int n_bytes)
 {
@@ -33,14 +36,388 @@ void append_int_msb(std::vector<uint8_t>& v, T x, int n_bytes)
 	}
 }
 
-//for binary streaming writing
-class buffered_binary_writer {
-#ifdef USE_ZSTD_FOR_TEMPS
-	refresh::zstd_file out{ 9 };
+//threads compressing (and writing) full buffers of buffered_binary_writers or decoding next record batches of bins in the background
+class async_task_pool {
+	refresh::parallel_queue<std::packaged_task<void()>> tasks;
+	std::vector<std::thread> threads;
+public:
+	async_task_pool(size_t n_threads) :
+		tasks(1024) {
+		for (size_t i = 0; i < n_threads; ++i)
+			threads.emplace_back([this] {
+				std::packaged_task<void()> task;
+				while (tasks.pop(task))
+					task();
+			});
+	}
+
+	std::future<void> submit(std::function<void()> f) {
+		std::packaged_task<void()> task(std::move(f));
+		auto res = task.get_future();
+		tasks.push(std::move(task));
+		return res;
+	}
+
+	~async_task_pool() {
+		tasks.mark_completed();
+		for (auto& t : threads)
+			t.join();
+	}
+};
+
+//entry of the index of SATC files with indexed layout (see Header)
+struct BlockIndexEntry {
+	uint64_t first_anchor;
+	uint64_t offset; //of zstd frame in the file
+	uint64_t n_recs;
+};
+
+//footer of indexed SATC file (not compressed, after the last frame):
+//n_blocks * (first_anchor, offset, n_recs), n_blocks, flags, magic (all 8 bytes little endian)
+struct BlockIndexFooter {
+	static constexpr uint64_t magic = 0x3158444943544153ull; //"SATCIDX1"
+	static constexpr uint64_t flag_sorted = 1; //anchors are non-decreasing in the whole file, so seek_to_anchor may be used
+	static constexpr uint64_t tail_size = 3 * sizeof(uint64_t);
+};
+
+//summary of records of a SATC file, known before the file is read (e.g. to estimate the cost of merging a bin)
+//footer (the last part of the file, after the index footer if indexed):
+//[zstd skippable frame header (only in compressed files, so decompressors skip the footer)]
+//n_recs, n_anchors, max_recs_per_anchor, tot_count, n_hist, hist, footer size in bytes, magic (all 8 bytes little endian)
+//hist[i] is the number of anchors with [2^i, 2^(i+1)) records
+//records of an anchor are expected to be consecutive (as stored by satc), otherwise each run is counted as a separate anchor
+struct BinStats {
+	static constexpr uint64_t magic = 0x3141545343544153ull; //"SATCSTA1"
+	static constexpr uint64_t tail_size = 2 * sizeof(uint64_t);
+	static constexpr uint32_t zstd_skippable_magic = 0x184D2A50;
+	static constexpr uint64_t zstd_skippable_header_size = 8;
+
+	uint64_t n_recs{};
+	uint64_t n_anchors{};
+	uint64_t max_recs_per_anchor{};
+	uint64_t tot_count{};
+	std::vector<uint64_t> hist;
+
+	//for adding records
+	uint64_t last_anchor{};
+	uint64_t cur_anchor_recs{};
+
+	void end_anchor() {
+		if (!cur_anchor_recs)
+			return;
+		max_recs_per_anchor = std::max(max_recs_per_anchor, cur_anchor_recs);
+		uint32_t bucket = 0;
+		while (cur_anchor_recs >> (bucket + 1))
+			++bucket;
+		if (hist.size() <= bucket)
+			hist.resize(bucket + 1);
+		++hist[bucket];
+		cur_anchor_recs = 0;
+	}
+
+	void Add(uint64_t anchor, uint64_t count) {
+		if (!n_recs || anchor != last_anchor) {
+			end_anchor();
+			++n_anchors;
+			last_anchor = anchor;
+		}
+		++cur_anchor_recs;
+		++n_recs;
+		tot_count += count;
+	}
+
+	//must be called after the last Add
+	void Finish() {
+		end_anchor();
+	}
+
+	void Clear() {
+		*this = BinStats{};
+	}
+
+	//without the skippable frame header
+	void Serialize(std::vector<uint64_t>& words) const {
+		words = { n_recs, n_anchors, max_recs_per_anchor, tot_count, hist.size() };
+		words.insert(words.end(), hist.begin(), hist.end());
+	}
+
+	bool Load(const std::vector<uint64_t>& words) {
+		if (words.size() < 5 || words.size() != 5 + words[4])
+			return false;
+		n_recs = words[0];
+		n_anchors = words[1];
+		max_recs_per_anchor = words[2];
+		tot_count = words[3];
+		hist.assign(words.begin() + 5, words.end());
+		return true;
+	}
+
+	//upper bound of the number of records of at least fraction of anchors (rounded up to 2^i - 1)
+	uint64_t RecsPerAnchorQuantile(double fraction) const {
+		uint64_t need = static_cast<uint64_t>(fraction * n_anchors);
+		uint64_t sum{};
+		for (size_t i = 0; i < hist.size(); ++i) {
+			sum += hist[i];
+			if (sum >= need)
+				return std::min<uint64_t>(max_recs_per_anchor, (2ull << i) - 1);
+		}
+		return max_recs_per_anchor;
+	}
+
+	void Print(std::ostream& oss) const {
+		oss << "Bin stats: \n";
+		oss << "\tn_recs                   : " << n_recs << "\n";
+		oss << "\tn_anchors                : " << n_anchors << "\n";
+		oss << "\tmax_recs_per_anchor      : " << max_recs_per_anchor << "\n";
+		oss << "\ttot_count                : " << tot_count << "\n";
+		oss << "\trecs per anchor histogram:\n";
+		for (size_t i = 0; i < hist.size(); ++i)
+			oss << "\t\t[" << (1ull << i) << ", " << (2ull << i) << "): " << hist[i] << "\n";
+	}
+};
+
+//block of records of columnar encoding, each field is stored as a separate stream:
+//sample_ids, barcodes:	number of runs, then (value, run length) pairs
+//anchors:				number of runs, then (zigzag delta to the previous run, run length) pairs
+//targets:				first in the anchor run as is, next as zigzag delta to the previous one
+//counts:				bit width of the largest count, then counts bit packed (LSB first)
+//all integers except bit packed counts are varints
+//low entropy columns are not interleaved with targets, so zstd compresses them better
+class ColumnarBlock {
+	static void put_varint(std::vector<uint8_t>& out, uint64_t x) {
+		while (x >= 0x80) {
+			out.push_back(static_cast<uint8_t>(x | 0x80));
+			x >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(x));
+	}
+	//false if the varint does not end before end (or is too long)
+	static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& x) {
+		x = 0;
+		for (uint32_t shift = 0; shift < 64 && p < end; shift += 7) {
+			uint8_t b = *p++;
+			x |= static_cast<uint64_t>(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+	static uint64_t zigzag(int64_t x) {
+		return (static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63);
+	}
+	static int64_t unzigzag(uint64_t x) {
+		return static_cast<int64_t>(x >> 1) ^ -static_cast<int64_t>(x & 1);
+	}
+
+	static void put_rle(std::vector<uint8_t>& out, const std::vector<uint64_t>& col) {
+		std::vector<std::pair<uint64_t, uint64_t>> runs;
+		for (auto x : col)
+			if (!runs.empty() && runs.back().first == x)
+				++runs.back().second;
+			else
+				runs.emplace_back(x, 1);
+		put_varint(out, runs.size());
+		for (auto& r : runs) {
+			put_varint(out, r.first);
+			put_varint(out, r.second);
+		}
+	}
+	//false if runs do not cover exactly n values
+	static bool get_rle(const uint8_t*& p, const uint8_t* end, std::vector<uint64_t>& col, size_t n) {
+		col.resize(n);
+		uint64_t n_runs;
+		if (!get_varint(p, end, n_runs))
+			return false;
+		size_t pos = 0;
+		for (uint64_t i = 0; i < n_runs; ++i) {
+			uint64_t val, len;
+			if (!get_varint(p, end, val) || !get_varint(p, end, len) || len > n - pos)
+				return false;
+			std::fill_n(col.begin() + pos, len, val);
+			pos += len;
+		}
+		return pos == n;
+	}
+public:
+	std::vector<uint64_t> sample_ids;
+	std::vector<uint64_t> barcodes;
+	std::vector<uint64_t> anchors;
+	std::vector<uint64_t> targets;
+	std::vector<uint64_t> counts;
+
+	size_t size() const {
+		return anchors.size();
+	}
+
+	void clear() {
+		sample_ids.clear();
+		barcodes.clear();
+		anchors.clear();
+		targets.clear();
+		counts.clear();
+	}
+
+	void push(uint64_t sample_id, uint64_t barcode, uint64_t anchor, uint64_t target, uint64_t count) {
+		sample_ids.push_back(sample_id);
+		barcodes.push_back(barcode);
+		anchors.push_back(anchor);
+		targets.push_back(target);
+		counts.push_back(count);
+	}
+
+	void encode(std::vector<uint8_t>& out) const {
+		const size_t n = size();
+		put_rle(out, sample_ids);
+		put_rle(out, barcodes);
+
+		std::vector<std::pair<uint64_t, uint64_t>> anchor_runs;
+		for (auto x : anchors)
+			if (!anchor_runs.empty() && anchor_runs.back().first == x)
+				++anchor_runs.back().second;
+			else
+				anchor_runs.emplace_back(x, 1);
+		put_varint(out, anchor_runs.size());
+		uint64_t prev_anchor = 0;
+		for (auto& r : anchor_runs) {
+			put_varint(out, zigzag(static_cast<int64_t>(r.first - prev_anchor)));
+			put_varint(out, r.second);
+			prev_anchor = r.first;
+		}
+
+		size_t i = 0;
+		for (auto& r : anchor_runs) {
+			put_varint(out, targets[i]);
+			for (size_t j = 1; j < r.second; ++j)
+				put_varint(out, zigzag(static_cast<int64_t>(targets[i + j] - targets[i + j - 1])));
+			i += r.second;
+		}
+
+		uint64_t max_count = 0;
+		for (auto x : counts)
+			max_count |= x;
+		uint32_t width = 0;
+		while (width < 64 && (max_count >> width))
+			++width;
+		out.push_back(static_cast<uint8_t>(width));
+		size_t first_byte = out.size();
+		out.resize(first_byte + (n * width + 7) / 8);
+		uint8_t* bits = out.data() + first_byte;
+		for (size_t k = 0; k < n; ++k) {
+			uint64_t x = counts[k];
+			size_t bit_pos = k * width;
+			for (uint32_t done = 0; done < width; ) {
+				uint32_t off = bit_pos % 8;
+				uint32_t take = std::min(8 - off, width - done);
+				bits[bit_pos / 8] |= static_cast<uint8_t>(((x >> done) & ((1u << take) - 1)) << off);
+				done += take;
+				bit_pos += take;
+			}
+		}
+	}
+
+	//false if the block (of encoded_size bytes) is corrupted
+	bool decode(const uint8_t* p, size_t encoded_size, size_t n) {
+		const uint8_t* end = p + encoded_size;
+		if (!get_rle(p, end, sample_ids, n) || !get_rle(p, end, barcodes, n))
+			return false;
+
+		anchors.resize(n);
+		targets.resize(n);
+		uint64_t n_runs;
+		if (!get_varint(p, end, n_runs) || n_runs > n)
+			return false;
+		std::vector<uint64_t> run_lens(n_runs);
+		uint64_t prev_anchor = 0;
+		size_t pos = 0;
+		for (uint64_t i = 0; i < n_runs; ++i) {
+			uint64_t delta;
+			if (!get_varint(p, end, delta) || !get_varint(p, end, run_lens[i]) || run_lens[i] > n - pos)
+				return false;
+			prev_anchor += static_cast<uint64_t>(unzigzag(delta));
+			std::fill_n(anchors.begin() + pos, run_lens[i], prev_anchor);
+			pos += run_lens[i];
+		}
+		if (pos != n)
+			return false;
+
+		pos = 0;
+		for (auto len : run_lens) {
+			if (len == 0)
+				continue;
+			if (!get_varint(p, end, targets[pos]))
+				return false;
+			for (size_t j = 1; j < len; ++j) {
+				uint64_t delta;
+				if (!get_varint(p, end, delta))
+					return false;
+				targets[pos + j] = targets[pos + j - 1] + static_cast<uint64_t>(unzigzag(delta));
+			}
+			pos += len;
+		}
+
+		if (p == end)
+			return false;
+		uint32_t width = *p++;
+		if (width > 64 || static_cast<size_t>(end - p) < (n * width + 7) / 8)
+			return false;
+		counts.resize(n);
+		for (size_t k = 0; k < n; ++k) {
+			uint64_t x = 0;
+			size_t bit_pos = k * width;
+			for (uint32_t done = 0; done < width; ) {
+				uint32_t off = bit_pos % 8;
+				uint32_t take = std::min(8 - off, width - done);
+				x |= static_cast<uint64_t>((p[bit_pos / 8] >> off) & ((1u << take) - 1)) << done;
+				done += take;
+				bit_pos += take;
+			}
+			counts[k] = x;
+		}
+		return true;
+	}
+};
+
+//position of the most significant set bit, x > 0
+inline uint32_t highest_set_bit(uint64_t x) {
+#ifdef _WIN32
+	unsigned long idx;
+	_BitScanReverse64(&idx, x);
+	return idx;
 #else
-	std::ofstream out;
+	return 63 - __builtin_clzll(x);
 #endif
+}
+
+//for binary streaming writing
+//if compression pool is given full buffer is compressed in the background while the second one is filled
+//(at most one pending task per writer, so the output stream stays in order)
+class buffered_binary_writer {
+	temp_file_writer out;
 	std::vector<uint8_t> buff;
+	std::vector<uint8_t> back_buff; //only for async mode, buffer being compressed
+	async_task_pool* compression_pool{};
+	std::future<void> pending;
+
+	//for bit packed records
+	uint64_t bit_acc{};
+	uint32_t n_bits{};
+
+	//indexed layout: each block is a separate zstd frame starting at an anchor boundary
+	static constexpr uint64_t index_block_n_recs = 1ull << 14;
+	bool indexed = false;
+	bool index_sorted = true;
+	uint64_t last_anchor{};
+	std::vector<BlockIndexEntry> index;
+	std::vector<uint64_t> frame_ends; //written by the compression task in async mode, [0] is the end of the header
+
+	//stats footer (see BinStats)
+	bool with_stats = false;
+	BinStats stats;
+
+	//for columnar records
+	static constexpr uint64_t columnar_block_n_recs = 1ull << 12;
+	ColumnarBlock columnar_block;
+	std::vector<uint8_t> columnar_encoded;
 
 	struct {
 		std::vector<uint8_t> prev_rec;
@@ -56,9 +433,134 @@ class buffered_binary_writer {
 		}
 	} compr_serialization;
 
-	void flush() {
-		out.write(reinterpret_cast<char*>(buff.data()), buff.size());
+	void wait_for_pending() {
+		if (pending.valid())
+			pending.get();
+	}
+
+	//last byte is padded with zeros
+	void flush_bits() {
+		if (n_bits) {
+			assure_space(1);
+			buff.push_back(static_cast<uint8_t>(bit_acc << (8 - n_bits)));
+			n_bits = 0;
+		}
+		bit_acc = 0;
+	}
+
+	void flush(bool end_frame = false) {
+		if (!compression_pool) {
+			out.write(reinterpret_cast<char*>(buff.data()), buff.size());
+			buff.clear();
+			if (end_frame)
+				end_out_frame();
+			return;
+		}
+		wait_for_pending();
+		std::swap(buff, back_buff);
 		buff.clear();
+		if (buff.capacity() < back_buff.capacity())
+			buff.reserve(back_buff.capacity());
+		pending = compression_pool->submit([this, end_frame] {
+			out.write(reinterpret_cast<char*>(back_buff.data()), back_buff.size());
+			if (end_frame)
+				end_out_frame();
+		});
+	}
+
+	void end_out_frame() {
+		out.end_frame();
+		frame_ends.push_back(out.tell());
+	}
+
+	//columnar block: n_recs, encoded size (both 8 bytes little endian), then encoded columns
+	void flush_columnar() {
+		if (!columnar_block.size())
+			return;
+		columnar_encoded.clear();
+		columnar_block.encode(columnar_encoded);
+		write_little_endian<uint64_t>(columnar_block.size());
+		write_little_endian<uint64_t>(columnar_encoded.size());
+		write(columnar_encoded.data(), columnar_encoded.size());
+		columnar_block.clear();
+	}
+
+	void reset_delta_states() {
+		compr_serialization.prev_rec.clear();
+		bit_packed_state.any = false;
+	}
+
+	//last block is finished and footer is stored
+	void finish_index() {
+		if (!indexed)
+			return;
+		flush_columnar();
+		flush_bits();
+		flush(true);
+		wait_for_pending();
+
+		std::vector<uint64_t> footer;
+		for (size_t i = 0; i < index.size(); ++i) {
+			footer.push_back(index[i].first_anchor);
+			footer.push_back(frame_ends[i]);
+			footer.push_back(index[i].n_recs);
+		}
+		footer.push_back(index.size());
+		footer.push_back(index_sorted ? BlockIndexFooter::flag_sorted : 0);
+		footer.push_back(BlockIndexFooter::magic);
+
+		std::vector<uint8_t> raw;
+		for (auto x : footer)
+			for (uint32_t b = 0; b < sizeof(x); ++b)
+				raw.push_back(static_cast<uint8_t>(x >> (8 * b)));
+		out.write_raw(reinterpret_cast<char*>(raw.data()), raw.size());
+		indexed = false;
+		index_sorted = true;
+		index.clear();
+		frame_ends.clear();
+	}
+
+	//called after finish_index, all data is flushed and the stats footer is stored
+	void finish_stats() {
+		if (!with_stats)
+			return;
+		flush_columnar();
+		flush_bits();
+		flush(true);
+		wait_for_pending();
+
+		stats.Finish();
+		std::vector<uint64_t> words;
+		stats.Serialize(words);
+		uint64_t payload_size = (words.size() + 2) * sizeof(uint64_t);
+		uint64_t footer_size = payload_size + (out.is_compressed() ? BinStats::zstd_skippable_header_size : 0);
+		words.push_back(footer_size);
+		words.push_back(BinStats::magic);
+
+		std::vector<uint8_t> raw;
+		if (out.is_compressed()) {
+			for (uint32_t b = 0; b < 4; ++b)
+				raw.push_back(static_cast<uint8_t>(BinStats::zstd_skippable_magic >> (8 * b)));
+			for (uint32_t b = 0; b < 4; ++b)
+				raw.push_back(static_cast<uint8_t>(payload_size >> (8 * b)));
+		}
+		for (auto x : words)
+			for (uint32_t b = 0; b < sizeof(x); ++b)
+				raw.push_back(static_cast<uint8_t>(x >> (8 * b)));
+		out.write_raw(reinterpret_cast<char*>(raw.data()), raw.size());
+		with_stats = false;
+		stats.Clear();
+	}
+
+	//all data (with footers) is passed to out
+	void finish() {
+		finish_index();
+		finish_stats();
+		flush_columnar();
+		flush_bits();
+		if (buff.size())
+			flush();
+		wait_for_pending();
 	}
 
 	void assure_space(size_t size) {
@@ -76,23 +578,53 @@ class buffered_binary_writer {
 	}
 
 public:
-	buffered_binary_writer(buffered_binary_writer&&) = default;
-	buffered_binary_writer& operator=(buffered_binary_writer&&) = default;
-	buffered_binary_writer(const std::string& path, size_t buff_size = 1ull << 25) {
-#ifdef USE_ZSTD_FOR_TEMPS
-		out.open_writing(path);
-#else
-		out.rdbuf()->pubsetbuf(0, 0);
-		out.open(path, std::ios::binary);
-#endif
-		buff.reserve(buff_size);
+	//the background task refers to this object, so it must be finished before moving
+	buffered_binary_writer(buffered_binary_writer&& rhs) noexcept {
+		*this = std::move(rhs);
+	}
+	buffered_binary_writer& operator=(buffered_binary_writer&& rhs) noexcept {
+		wait_for_pending();
+		rhs.wait_for_pending();
+		out = std::move(rhs.out);
+		buff = std::move(rhs.buff);
+		back_buff = std::move(rhs.back_buff);
+		compression_pool = rhs.compression_pool;
+		compr_serialization = std::move(rhs.compr_serialization);
+		bit_acc = rhs.bit_acc;
+		n_bits = rhs.n_bits;
+		bit_packed_state = rhs.bit_packed_state;
+		indexed = rhs.indexed;
+		index_sorted = rhs.index_sorted;
+		last_anchor = rhs.last_anchor;
+		index = std::move(rhs.index);
+		frame_ends = std::move(rhs.frame_ends);
+		with_stats = rhs.with_stats;
+		stats = std::move(rhs.stats);
+		rhs.with_stats = false;
+		columnar_block = std::move(rhs.columnar_block);
+		rhs.columnar_block.clear();
+		rhs.n_bits = 0;
+		rhs.indexed = false;
+		return *this;
+	}
+
+	//in async mode there are two buffers of buff_size / 2
+	buffered_binary_writer(const std::string& path, size_t buff_size = 1ull << 25, async_task_pool* compression_pool = nullptr, const TempCodec& codec = TempCodec::Default()) :
+		out(codec),
+		compression_pool(compression_pool) {
+		out.open(path);
+		buff.reserve(compression_pool ? buff_size / 2 : buff_size);
+	}
+
+	//bin of a container, which must live until the writer is closed (or reopened)
+	buffered_binary_writer(BinContainerWriter& container, uint32_t bin_id, size_t buff_size = 1ull << 25, async_task_pool* compression_pool = nullptr, const TempCodec& codec = TempCodec::Default()) :
+		out(codec),
+		compression_pool(compression_pool) {
+		out.open(container, bin_id);
+		buff.reserve(compression_pool ? buff_size / 2 : buff_size);
 	}
 	operator bool() const {
-#ifdef USE_ZSTD_FOR_TEMPS
-		return out.is_opened_for_writing();
-#else
-		return out.operator bool();
-#endif
+		return out.is_open();
 	}
 	void write(const uint8_t* ptr, size_t size) {
 		assure_space(size);
@@ -114,43 +646,204 @@ public:
 		std::swap(compr_serialization.prev_rec, rec);
 	}
 
+	//MSB first, n <= 64
+	void write_bits(uint64_t x, uint32_t n) {
+		if (n > 32) {
+			write_bits(x >> 32, n - 32);
+			n = 32;
+		}
+		if (n == 0)
+			return;
+		bit_acc = (bit_acc << n) | (x & ((1ull << n) - 1));
+		n_bits += n;
+		if (n_bits >= 8) {
+			assure_space(5);
+			while (n_bits >= 8) {
+				n_bits -= 8;
+				buff.push_back(static_cast<uint8_t>(bit_acc >> n_bits));
+			}
+		}
+	}
+
+	//Elias gamma code, x > 0
+	void write_gamma(uint64_t x) {
+		assert(x);
+		uint32_t n = highest_set_bit(x);
+		write_bits(0, n);
+		write_bits(x, n + 1);
+	}
+
+	//previous record, for delta coding of bit packed records
+	struct {
+		uint64_t sample_id;
+		uint64_t anchor;
+		uint64_t target;
+		bool any = false;
+	} bit_packed_state;
+
+	void write_columnar(uint64_t sample_id, uint64_t barcode, uint64_t anchor, uint64_t target, uint64_t count) {
+		columnar_block.push(sample_id, barcode, anchor, target, count);
+		if (columnar_block.size() >= columnar_block_n_recs)
+			flush_columnar();
+	}
+
+	//called just after the header is written, the header is a separate frame
+	void start_index() {
+		flush_bits();
+		flush(true);
+		indexed = true;
+		index_sorted = true;
+		index.clear();
+	}
+
+	//called just after the header is written
+	void start_stats() {
+		with_stats = true;
+		stats.Clear();
+	}
+
+	//called for each record if stats are stored
+	void add_to_stats(uint64_t anchor, uint64_t count) {
+		stats.Add(anchor, count);
+	}
+
+	//called before each record of indexed file, starts a new block if the current one is full
+	//records of a single anchor are never split between blocks (if anchors are sorted)
+	void index_record(uint64_t anchor) {
+		if (!index.empty() && anchor < last_anchor)
+			index_sorted = false;
+		if (index.empty() || (anchor != last_anchor && index.back().n_recs >= index_block_n_recs)) {
+			if (!index.empty()) {
+				flush_columnar();
+				flush_bits();
+				flush(true);
+			}
+			index.push_back({ anchor, 0, 0 });
+			reset_delta_states();
+		}
+		++index.back().n_recs;
+		last_anchor = anchor;
+	}
+
 	~buffered_binary_writer() {
+		finish_index();
+		finish_stats();
+		flush_columnar();
+		flush_bits();
 		if (buff.size())
 			flush();
+		wait_for_pending();
 	}
 	void close() {
-		if (buff.size())
-			flush();
+		finish();
 		out.close();
 	}
+
+	//close current file and start writing to a new one reusing buffers (and compression context)
+	bool reopen(const std::string& path) {
+		finish();
+		reset_delta_states();
+		return out.reopen(path);
+	}
+
+	//as above, but a bin of a container is written
+	bool reopen(BinContainerWriter& container, uint32_t bin_id) {
+		finish();
+		reset_delta_states();
+		return out.reopen(container, bin_id);
+	}
 };
 
 //for binary streaming reading
 class buffered_binary_reader {
-#ifdef USE_ZSTD_FOR_TEMPS
-	refresh::zstd_file in;
-#else
-	std::ifstream in;
-#endif
+	temp_file_reader in;
 	std::vector<uint8_t> buff;
 	uint8_t* ptr{};
 	size_t in_buff{};
 
 	std::vector<uint8_t> prev_rec;
 
+	//for bit packed records
+	uint64_t bit_acc{};
+	uint32_t n_bits{};
+
+	//indexed layout
+	std::string path; //of the physical file
+	uint64_t base_offset{}; //of the bin in the file (nonzero for bins in a container)
+	size_t file_size{}; //of the bin
+	bool indexed = false;
+	bool index_sorted = false;
+	std::vector<BlockIndexEntry> index;
+	uint64_t data_end{}; //footer start
+	size_t next_block{};
+	uint64_t recs_left_in_block{};
+
+	//stats footer
+	bool with_stats = false;
+	BinStats stats;
+
+	//for columnar records, the whole block is decoded at once
+	ColumnarBlock columnar_block;
+	size_t columnar_pos{};
+	std::vector<uint8_t> columnar_encoded;
+
+	void reset_columnar() {
+		columnar_block.clear();
+		columnar_pos = 0;
+	}
+
+	//may be larger than the buffer
+	bool read_bytes(std::vector<uint8_t>& vec, size_t to_read) {
+		vec.resize(to_read);
+		return read_raw(vec.data(), to_read) == to_read;
+	}
+
+	bool read_footer_u64s(FILE* f, uint64_t offset, std::vector<uint64_t>& res, size_t n) {
+		return bin_container_read_u64s(f, base_offset + offset, res, n);
+	}
+
+	void load_footer() {
+		FILE* f = fopen(path.c_str(), "rb");
+		std::vector<uint64_t> tail;
+		if (!f || file_size < BlockIndexFooter::tail_size || !read_footer_u64s(f, file_size - BlockIndexFooter::tail_size, tail, 3) || tail[2] != BlockIndexFooter::magic) {
+			std::cerr << "Error: corrupted index of " << path << "\n";
+			exit(1);
+		}
+		uint64_t n_blocks = tail[0];
+		index_sorted = tail[1] & BlockIndexFooter::flag_sorted;
+		data_end = file_size - BlockIndexFooter::tail_size - n_blocks * 3 * sizeof(uint64_t);
+
+		std::vector<uint64_t> entries;
+		if (!read_footer_u64s(f, data_end, entries, 3 * n_blocks)) {
+			std::cerr << "Error: corrupted index of " << path << "\n";
+			exit(1);
+		}
+		fclose(f);
+		index.resize(n_blocks);
+		for (size_t i = 0; i < n_blocks; ++i)
+			index[i] = { entries[3 * i], entries[3 * i + 1], entries[3 * i + 2] };
+	}
+
+	void jump_to_block(size_t block_id) {
+		uint64_t offset = block_id < index.size() ? index[block_id].offset : data_end;
+		in.seek_reading(offset, data_end);
+		ptr = buff.data();
+		in_buff = 0;
+		next_block = block_id;
+		recs_left_in_block = 0;
+		bit_acc = 0;
+		n_bits = 0;
+		reset_columnar();
+	}
+
 	void load()
 	{
 		//copy tail
 		auto tail_size = buff.data() + in_buff - ptr;
 		std::copy_n(buff.data() + buff.size() - tail_size, tail_size, buff.data());
 		//read
-#ifdef USE_ZSTD_FOR_TEMPS
 		auto readed = in.read(reinterpret_cast<char*>(buff.data() + tail_size), buff.size() - tail_size);
 		in_buff = tail_size + readed;
-#else
-		in.read(reinterpret_cast<char*>(buff.data() + tail_size), buff.size() - tail_size);
-		in_buff = tail_size + in.gcount();
-#endif
 		ptr = buff.data();
 	}
 	bool assure_data_in_buffer(size_t size) {
@@ -173,47 +866,48 @@ class buffered_binary_reader {
 		return true;
 	}
 
+	//at least the size of the largest field, so truncated files are reported as such
 	size_t calc_buff_size(size_t fsize, size_t max_size) {
-		return fsize < max_size ? fsize : max_size;
+		return std::max<size_t>(fsize < max_size ? fsize : max_size, 64);
 	}
 
-	size_t get_file_size(const std::string& path) {
-		FILE* f = fopen(path.c_str(), "rb");
-		if (!f) {
-			std::cerr << "Error: cannot open file " << path << " to get file size\n";
-			exit(1);
+	struct BinLocation {
+		std::string file_path;
+		uint64_t offset;
+		uint64_t size;
+		bool in_container;
+		BinLocation(const std::string& path) {
+			in_container = locate_bin(path, file_path, offset, size);
 		}
-		fseek(f, 0, SEEK_END);
-		size_t fsize = ftell(f);
-		fclose(f);
+	};
 
-		return fsize;
-	}
-	buffered_binary_reader(const std::string& path, size_t file_size, size_t max_buff_size) :
-#ifdef USE_ZSTD_FOR_TEMPS
-	in(9, calc_buff_size(file_size, 1 << 20), 1 << 13),
-#endif
-	 buff(calc_buff_size(file_size, max_buff_size)) {
-#ifdef USE_ZSTD_FOR_TEMPS
-		in.open_reading(path);
-#else
-		in.rdbuf()->pubsetbuf(0, 0);
-		in.open(path, std::ios::binary);
-#endif
+	buffered_binary_reader(const BinLocation& loc, size_t max_buff_size, const TempCodec& codec) :
+	in(calc_buff_size(loc.size, 1 << 20), 1 << 13),
+	 buff(calc_buff_size(loc.size, max_buff_size)),
+	 path(loc.file_path),
+	 base_offset(loc.offset),
+	 file_size(loc.size) {
+		if (loc.in_container)
+			in.open(path, codec, base_offset, file_size);
+		else
+			in.open(path, codec);
 		ptr = buff.data();
 	}
 public:
-	buffered_binary_reader(const std::string& path, size_t buff_size = 1ull << 13) :
-		buffered_binary_reader(path, get_file_size(path), buff_size) { //delegate ctor, to get file size only once
+	//codec is needed only if the file was compressed with a dictionary
+	//path may also point to a bin in a container (<container>.bins:<bin id>)
+	buffered_binary_reader(const std::string& path, size_t buff_size = 1ull << 16, const TempCodec& codec = TempCodec::Default()) :
+		buffered_binary_reader(BinLocation(path), buff_size, codec) { //delegate ctor, to locate the bin only once
 
 	}
 
 	operator bool() const {
-#ifdef USE_ZSTD_FOR_TEMPS
-		return in.is_opened_for_reading();
-#else
-		return in.operator bool();
-#endif
+		return in.is_open();
+	}
+
+	//of the physical file (the container for a bin in a container)
+	const std::string& get_path() const {
+		return path;
 	}
 
 	bool read(uint8_t*& _ptr, size_t size) {
@@ -239,22 +933,214 @@ public:
 		return true;
 	}
 
-	bool read_rec_compr(std::vector<uint8_t>& vec, size_t rec_len) {
-		vec.clear();
+	//decodes the record in place, rec points to the internal buffer valid until the next call
+	bool read_rec_compr(const uint8_t*& rec, size_t rec_len) {
 		uint8_t n_common{};
 		if (!read_little_endian(n_common)) //endianness does not matter for 1 byte
 			return false;
 
-		for (size_t i = 0; i < n_common; ++i)
-			vec.push_back(prev_rec[i]);
+		if (prev_rec.size() != rec_len)
+			prev_rec.resize(rec_len);
 
-		if (!read(vec, rec_len - n_common))
+		if (!assure_data_in_buffer(rec_len - n_common))
 		{
 			std::cerr << "Error: only part of the record was stored in the file\n";
 			exit(1);
 		}
+		std::copy_n(ptr, rec_len - n_common, prev_rec.data() + n_common);
+		ptr += rec_len - n_common;
+
+		rec = prev_rec.data();
+		return true;
+	}
+
+
+	//MSB first, n <= 64
+	bool read_bits(uint64_t& x, uint32_t n) {
+		if (n > 32) {
+			uint64_t hi;
+			if (!read_bits(hi, n - 32))
+				return false;
+			if (!read_bits(x, 32))
+				return false;
+			x |= hi << 32;
+			return true;
+		}
+		while (n_bits < n) {
+			if (!assure_data_in_buffer(1))
+				return false;
+			bit_acc = (bit_acc << 8) | *ptr++;
+			n_bits += 8;
+		}
+		n_bits -= n;
+		x = n ? (bit_acc >> n_bits) & ((1ull << n) - 1) : 0;
+		return true;
+	}
+
+	bool read_bit(bool& bit) {
+		uint64_t x;
+		if (!read_bits(x, 1))
+			return false;
+		bit = x;
+		return true;
+	}
+
+	//leading zeros are counted on all buffered bits at once (not bit by bit)
+	bool read_gamma(uint64_t& x) {
+		uint32_t n = 0;
+		while (true) {
+			uint64_t valid = n_bits == 64 ? bit_acc : bit_acc & ((1ull << n_bits) - 1);
+			if (valid) {
+				uint32_t zeros = n_bits - 1 - highest_set_bit(valid);
+				n += zeros;
+				n_bits -= zeros + 1;
+				break;
+			}
+			n += n_bits;
+			n_bits = 0;
+			while (n_bits <= 56 && assure_data_in_buffer(1)) {
+				bit_acc = (bit_acc << 8) | *ptr++;
+				n_bits += 8;
+			}
+			if (!n_bits || n >= 64)
+				return false;
+		}
+		if (n >= 64)
+			return false;
+		if (!read_bits(x, n))
+			return false;
+		x |= 1ull << n;
+		return true;
+	}
+
+	//previous record, for delta coding of bit packed records
+	struct {
+		uint64_t sample_id;
+		uint64_t anchor;
+		uint64_t target;
+		bool any = false;
+	} bit_packed_state;
+
+	bool read_columnar(uint64_t& sample_id, uint64_t& barcode, uint64_t& anchor, uint64_t& target, uint64_t& count) {
+		if (columnar_pos == columnar_block.size()) {
+			uint64_t n_recs, encoded_size;
+			if (!read_little_endian(n_recs))
+				return false;
+			if (!read_little_endian(encoded_size) || !read_bytes(columnar_encoded, encoded_size)) {
+				std::cerr << "Error: only part of the columnar block was stored in the file\n";
+				exit(1);
+			}
+			if (!columnar_block.decode(columnar_encoded.data(), columnar_encoded.size(), n_recs)) {
+				std::cerr << "Error: corrupted columnar block of " << path << "\n";
+				exit(1);
+			}
+			columnar_pos = 0;
+		}
+		sample_id = columnar_block.sample_ids[columnar_pos];
+		barcode = columnar_block.barcodes[columnar_pos];
+		anchor = columnar_block.anchors[columnar_pos];
+		target = columnar_block.targets[columnar_pos];
+		count = columnar_block.counts[columnar_pos];
+		++columnar_pos;
+		return true;
+	}
+
+	//bytes as stored (e.g. for dictionary training), returns the number of bytes read (less than size only at the end of data)
+	size_t read_raw(uint8_t* dst, size_t size) {
+		size_t done = 0;
+		while (done < size) {
+			if (ptr == buff.data() + in_buff) {
+				load();
+				if (!in_buff)
+					break;
+			}
+			size_t n = std::min<size_t>(size - done, buff.data() + in_buff - ptr);
+			std::copy_n(ptr, n, dst + done);
+			ptr += n;
+			done += n;
+		}
+		return done;
+	}
+
+	//called just after the header is read (before open_index), the footer is excluded from data
+	void open_stats() {
+		FILE* f = fopen(path.c_str(), "rb");
+		std::vector<uint64_t> tail, words;
+		if (!f || file_size < BinStats::tail_size || !read_footer_u64s(f, file_size - BinStats::tail_size, tail, 2) || tail[1] != BinStats::magic || tail[0] > file_size) {
+			std::cerr << "Error: corrupted stats footer of " << path << "\n";
+			exit(1);
+		}
+		uint64_t skip = in.is_compressed() ? BinStats::zstd_skippable_header_size : 0;
+		uint64_t footer_start = file_size - tail[0];
+		if (tail[0] < skip + BinStats::tail_size || !read_footer_u64s(f, footer_start + skip, words, (tail[0] - skip - BinStats::tail_size) / sizeof(uint64_t)) || !stats.Load(words)) {
+			std::cerr << "Error: corrupted stats footer of " << path << "\n";
+			exit(1);
+		}
+		fclose(f);
+		with_stats = true;
+		file_size = footer_start;
+
+		//compressed data ends with the last frame (footer is a skippable frame), plain data must be cut explicitly
+		//header is small, so it was read by a single load from the beginning of the file
+		if (!in.is_compressed()) {
+			uint64_t pos = ptr - buff.data();
+			in.seek_reading(pos, file_size);
+			ptr = buff.data();
+			in_buff = 0;
+		}
+	}
+
+	bool has_stats() const {
+		return with_stats;
+	}
+
+	const BinStats& get_stats() const {
+		return stats;
+	}
 
-		prev_rec = vec;
+	//called just after the header of indexed file is read
+	void open_index() {
+		indexed = true;
+		load_footer();
+		jump_to_block(0);
+	}
+
+	//indexed and anchors sorted
+	bool is_seekable() const {
+		return indexed && index_sorted;
+	}
+
+	//called before each record, false if there are no more blocks
+	//each block is decoded independently, so delta coding states are reset at its start
+	bool start_record() {
+		if (!indexed)
+			return true;
+		if (!recs_left_in_block) {
+			if (next_block >= index.size())
+				return false;
+			recs_left_in_block = index[next_block++].n_recs;
+			prev_rec.clear();
+			bit_packed_state.any = false;
+			//blocks are byte aligned, so only the padding is dropped, whole bytes may be already read by read_gamma
+			n_bits -= n_bits % 8;
+			reset_columnar();
+		}
+		--recs_left_in_block;
+		return true;
+	}
+
+	//jumps to the beginning of the block that may contain the anchor if it is after the current block
+	//true if jumped, records that would be read before the jump are skipped (all have smaller anchors)
+	//false also if the file is not indexed or anchors are not sorted, then the caller should just continue reading
+	bool seek_to_anchor(uint64_t anchor) {
+		if (!indexed || !index_sorted)
+			return false;
+		auto it = std::upper_bound(index.begin(), index.end(), anchor, [](uint64_t a, const BlockIndexEntry& e) {return a < e.first_anchor; });
+		size_t block_id = it == index.begin() ? 0 : it - index.begin() - 1;
+		//next_block - 1 is the block of the last record read
+		if (block_id < next_block || (block_id == next_block && !recs_left_in_block))
+			return false;
+		jump_to_block(block_id);
 		return true;
 	}
 
@@ -277,6 +1163,18 @@ bool LoadBigEndian(std::vector<uint8_t>::iterator& p, T& data, uint8_t data_size
 	return true;
 }
 
+template<typename T>
+void LoadBigEndian(const uint8_t*& p, T& data, uint8_t data_size_in_bytes)
+{
+	data = T{};
+
+	for (int i = 0; i < data_size_in_bytes; ++i, ++p)
+	{
+		data <<= 8;
+		data += (T)*p;
+	}
+}
+
 inline uint32_t get_rev_compl_shift(uint32_t len)
 {
 	return (len + 31) / 32 * 32 - len;
@@ -321,28 +1219,80 @@ inline uint64_t str_kmer_to_uint64_t(const std::string& kmer) {
 }
 
 inline std::string kmer_to_string(uint64_t kmer, uint8_t len) {
-	std::string str_kmer;
-	for (int i = len - 1; i >= 0; --i) {
-		auto s = (kmer >> (2 * i)) & 3;
-		str_kmer.push_back("ACGT"[s]);
-	}
+	std::string str_kmer(len, 'A');
+	decode_kmer(kmer, len, str_kmer.data());
 	return str_kmer;
 }
 
+//encoding of records following the header
+//prefix_diff: records are MSB packed to whole bytes, each preceded by the number of bytes common with the previous record
+//bit_packed: records are bit packed, anchors and targets delta coded (if sorted), counts Elias gamma coded
+//columnar: records are grouped in blocks, each field of a block stored as a separate stream (see ColumnarBlock)
+enum class RecEncoding : uint8_t { prefix_diff = 0, bit_packed = 1, columnar = 2 };
+
+inline RecEncoding rec_encoding_from_string(const std::string& str) {
+	if (str == "prefix_diff")
+		return RecEncoding::prefix_diff;
+	if (str == "bit_packed")
+		return RecEncoding::bit_packed;
+	if (str == "columnar")
+		return RecEncoding::columnar;
+	std::cerr << "Error: unknown record encoding: " << str << "\n";
+	exit(1);
+}
+
+inline std::string to_string(RecEncoding encoding) {
+	switch (encoding) {
+	case RecEncoding::prefix_diff:
+		return "prefix_diff";
+	case RecEncoding::bit_packed:
+		return "bit_packed";
+	case RecEncoding::columnar:
+		return "columnar";
+	default:
+		std::cerr << "Error: unsupported record encoding, please contact authors showing this message: " << __FILE__ << ":" << __LINE__ << "\n";
+		exit(1);
+	}
+}
+
+//headers of files with encoding other than prefix_diff start with extended_header_marker (impossible value of sample_id_size_bytes),
+//followed by the version and the encoding, then the original header
+//files with prefix_diff encoding have the original header only, so they are readable by older versions
+//version 2 (SATC v2) adds flags byte after the encoding, the only flag is indexed layout:
+//the header is a separate zstd frame, records are stored in blocks (separate frames) starting at anchor boundaries
+//and the file ends with the index of blocks (BlockIndexFooter), so readers may jump to the block of a given anchor
 struct Header {
-	uint8_t sample_id_size_bytes;
-	uint8_t barcode_size_bytes;
-	uint8_t anchor_size_bytes;
-	uint8_t target_size_bytes;
-	uint8_t counter_size_bytes;
-	uint8_t barcode_len_symbols;
-	uint8_t anchor_len_symbols;
-	uint8_t target_len_symbols;
-	uint8_t gap_len_symbols;
-
-	uint32_t rec_len;
+	static constexpr uint8_t extended_header_marker = 0xFF;
+	static constexpr uint8_t extended_header_version = 2;
+	static constexpr uint8_t flag_indexed = 1;
+	static constexpr uint8_t flag_stats = 2;
+
+	RecEncoding encoding = RecEncoding::prefix_diff;
+	bool indexed = false;
+	bool with_stats = false; //BinStats footer
+
+	uint8_t sample_id_size_bytes{};
+	uint8_t barcode_size_bytes{};
+	uint8_t anchor_size_bytes{};
+	uint8_t target_size_bytes{};
+	uint8_t counter_size_bytes{};
+	uint8_t barcode_len_symbols{};
+	uint8_t anchor_len_symbols{};
+	uint8_t target_len_symbols{};
+	uint8_t gap_len_symbols{};
+
+	uint32_t rec_len{};
 
 	void serialize(buffered_binary_writer& out) {
+		if (encoding != RecEncoding::prefix_diff || indexed || with_stats) {
+			//version 1 if possible, it is just one byte shorter (only plain prefix_diff files are readable by older versions)
+			uint8_t version = indexed || with_stats ? 2 : 1;
+			out.write_little_endian(extended_header_marker);
+			out.write_little_endian(version);
+			out.write_little_endian(static_cast<uint8_t>(encoding));
+			if (version >= 2)
+				out.write_little_endian(static_cast<uint8_t>((indexed ? flag_indexed : 0) | (with_stats ? flag_stats : 0)));
+		}
 		out.write_little_endian(sample_id_size_bytes);
 		out.write_little_endian(barcode_size_bytes);
 		out.write_little_endian(anchor_size_bytes);
@@ -352,24 +1302,62 @@ struct Header {
 		out.write_little_endian(anchor_len_symbols);
 		out.write_little_endian(target_len_symbols);
 		out.write_little_endian(gap_len_symbols);
+		if (indexed)
+			out.start_index();
+		if (with_stats)
+			out.start_stats();
 	}
 
 	void load(buffered_binary_reader& in) {
-		in.read_little_endian(sample_id_size_bytes);
-		in.read_little_endian(barcode_size_bytes);
-		in.read_little_endian(anchor_size_bytes);
-		in.read_little_endian(target_size_bytes);
-		in.read_little_endian(counter_size_bytes);
-		in.read_little_endian(barcode_len_symbols);
-		in.read_little_endian(anchor_len_symbols);
-		in.read_little_endian(target_len_symbols);
-		in.read_little_endian(gap_len_symbols);
+		encoding = RecEncoding::prefix_diff;
+		indexed = false;
+		with_stats = false;
+		bool ok = in.read_little_endian(sample_id_size_bytes);
+		if (ok && sample_id_size_bytes == extended_header_marker) {
+			uint8_t version{}, enc{}, flags{};
+			ok = in.read_little_endian(version) && in.read_little_endian(enc);
+			if (ok && version >= 2)
+				ok = in.read_little_endian(flags);
+			if (!ok) {
+				std::cerr << "Error: truncated header of " << in.get_path() << "\n";
+				exit(1);
+			}
+			if (version > extended_header_version || enc > static_cast<uint8_t>(RecEncoding::columnar) || (flags & ~(flag_indexed | flag_stats))) {
+				std::cerr << "Error: unsupported file version, probably created by a newer version of the software\n";
+				exit(1);
+			}
+			encoding = static_cast<RecEncoding>(enc);
+			indexed = flags & flag_indexed;
+			with_stats = flags & flag_stats;
+			ok = in.read_little_endian(sample_id_size_bytes);
+		}
+		ok = ok &&
+			in.read_little_endian(barcode_size_bytes) &&
+			in.read_little_endian(anchor_size_bytes) &&
+			in.read_little_endian(target_size_bytes) &&
+			in.read_little_endian(counter_size_bytes) &&
+			in.read_little_endian(barcode_len_symbols) &&
+			in.read_little_endian(anchor_len_symbols) &&
+			in.read_little_endian(target_len_symbols) &&
+			in.read_little_endian(gap_len_symbols);
+		if (!ok) {
+			std::cerr << "Error: truncated header of " << in.get_path() << "\n";
+			exit(1);
+		}
 
 		rec_len = sample_id_size_bytes + barcode_size_bytes + anchor_size_bytes + target_size_bytes + counter_size_bytes;
+
+		if (with_stats)
+			in.open_stats();
+		if (indexed)
+			in.open_index();
 	}
 
 	void print(std::ostream& oss) {
 		oss << "Header: \n";
+		oss << "\trecord encoding          : " << to_string(encoding) << "\n";
+		oss << "\tindexed                  : " << std::boolalpha << indexed << "\n";
+		oss << "\twith stats               : " << std::boolalpha << with_stats << "\n";
 		oss << "\tsample_id_size_bytes     : " << (uint64_t)sample_id_size_bytes << "\n";
 		oss << "\tbarcode_size_bytes       : " << (uint64_t)barcode_size_bytes << "\n";
 		oss << "\tanchor_size_bytes        : " << (uint64_t)anchor_size_bytes << "\n";
@@ -434,7 +1422,9 @@ public:
 		}
 	}
 
-	void store_sample_id(std::ostream& oss, size_t id) const {
+	//OUT is std::ostream or TextWriter
+	template<typename OUT>
+	void store_sample_id(OUT& oss, size_t id) const {
 		if(can_decode) {
 			assert(id < decoded.size());
 			oss << decoded[id];
@@ -506,47 +1496,171 @@ private:
 		append_int_msb(out, count, header.counter_size_bytes);
 	}
 
-	void load_msb(std::vector<uint8_t>& in, const Header& header) {
-		auto p = in.begin();
+	void load_msb(const uint8_t* p, const Header& header) {
 		LoadBigEndian(p, sample_id, header.sample_id_size_bytes);
 		LoadBigEndian(p, barcode, header.barcode_size_bytes);
 		LoadBigEndian(p, anchor, header.anchor_size_bytes);
 		LoadBigEndian(p, target, header.target_size_bytes);
 		LoadBigEndian(p, count, header.counter_size_bytes);
 	}
+
+	//each record starts with 1 bit (0 bit or end of data means no more records):
+	//sample_id:	0 - same as previous, 1 - followed by sample_id_size_bytes * 8 bits
+	//barcode:		barcode_len_symbols * 2 bits (if present)
+	//anchor:		0 - same as previous, 10 - followed by gamma(anchor - prev_anchor), 11 - followed by anchor_len_symbols * 2 bits
+	//target:		0 - followed by gamma(target - prev_target) (only if anchor and sample_id are the same as previous), 1 - followed by target_len_symbols * 2 bits
+	//count:		gamma(count + 1)
+	void serialize_bit_packed(buffered_binary_writer& out, const Header& header) {
+		auto& prev = out.bit_packed_state;
+		out.write_bits(1, 1);
+
+		bool same_sample = prev.any && prev.sample_id == sample_id;
+		if (same_sample)
+			out.write_bits(0, 1);
+		else {
+			out.write_bits(1, 1);
+			out.write_bits(sample_id, 8 * header.sample_id_size_bytes);
+		}
+
+		out.write_bits(barcode, 2 * header.barcode_len_symbols);
+
+		bool same_anchor = prev.any && prev.anchor == anchor;
+		if (same_anchor)
+			out.write_bits(0, 1);
+		else if (prev.any && anchor > prev.anchor) {
+			out.write_bits(0b10, 2);
+			out.write_gamma(anchor - prev.anchor);
+		}
+		else {
+			out.write_bits(0b11, 2);
+			out.write_bits(anchor, 2 * header.anchor_len_symbols);
+		}
+
+		if (same_sample && same_anchor && target > prev.target) {
+			out.write_bits(0, 1);
+			out.write_gamma(target - prev.target);
+		}
+		else {
+			out.write_bits(1, 1);
+			out.write_bits(target, 2 * header.target_len_symbols);
+		}
+
+		out.write_gamma(count + 1);
+
+		prev.sample_id = sample_id;
+		prev.anchor = anchor;
+		prev.target = target;
+		prev.any = true;
+	}
+
+	bool load_bit_packed(buffered_binary_reader& in, const Header& header) {
+		auto& prev = in.bit_packed_state;
+		bool bit;
+		if (!in.read_bit(bit) || !bit)
+			return false;
+
+		bool ok = in.read_bit(bit);
+		bool same_sample = !bit;
+		if (!same_sample)
+			ok = ok && in.read_bits(sample_id, 8 * header.sample_id_size_bytes);
+		else
+			sample_id = prev.sample_id;
+
+		ok = ok && in.read_bits(barcode, 2 * header.barcode_len_symbols);
+
+		ok = ok && in.read_bit(bit);
+		bool same_anchor = !bit;
+		if (same_anchor)
+			anchor = prev.anchor;
+		else {
+			ok = ok && in.read_bit(bit);
+			if (!bit) {
+				uint64_t delta;
+				ok = ok && in.read_gamma(delta);
+				anchor = prev.anchor + delta;
+			}
+			else
+				ok = ok && in.read_bits(anchor, 2 * header.anchor_len_symbols);
+		}
+
+		ok = ok && in.read_bit(bit);
+		if (!bit) {
+			uint64_t delta;
+			ok = ok && in.read_gamma(delta);
+			target = prev.target + delta;
+		}
+		else
+			ok = ok && in.read_bits(target, 2 * header.target_len_symbols);
+
+		ok = ok && in.read_gamma(count);
+		--count;
+
+		if (!ok) {
+			std::cerr << "Error: only part of the record was stored in the file\n";
+			exit(1);
+		}
+
+		prev.sample_id = sample_id;
+		prev.anchor = anchor;
+		prev.target = target;
+		prev.any = true;
+		return true;
+	}
 public:
 	void serialize(buffered_binary_writer& out, const Header& header) {
+		if (header.with_stats)
+			out.add_to_stats(anchor, count);
+		if (header.indexed)
+			out.index_record(anchor);
+		if (header.encoding == RecEncoding::bit_packed) {
+			serialize_bit_packed(out, header);
+			return;
+		}
+		if (header.encoding == RecEncoding::columnar) {
+			out.write_columnar(sample_id, barcode, anchor, target, count);
+			return;
+		}
 		compr_record.clear();
 		serialize_msb(compr_record, header);
 		out.write_rec_compr(compr_record);
 	};
 
 	bool load(buffered_binary_reader& in, const Header& header) {
-		if (!in.read_rec_compr(compr_record, header.rec_len))
+		if (!in.start_record())
+			return false;
+		if (header.encoding == RecEncoding::bit_packed)
+			return load_bit_packed(in, header);
+		if (header.encoding == RecEncoding::columnar)
+			return in.read_columnar(sample_id, barcode, anchor, target, count);
+
+		const uint8_t* rec;
+		if (!in.read_rec_compr(rec, header.rec_len))
 			return false;
 
-		load_msb(compr_record, header);
+		load_msb(rec, header);
 
 		return true;
 	}
 
-	void print(std::ostream& oss, const Header& header, RecFmt format = RecFmt::SATC, const SampleNameDecoder& sample_name_decoder = SampleNameDecoder("")) {
+	//OUT is std::ostream or TextWriter (much faster for large outputs)
+	template<typename OUT>
+	void print(OUT& oss, const Header& header, RecFmt format, const SampleNameDecoder& sample_name_decoder) const {
 		if (format == RecFmt::SATC) {
 			sample_name_decoder.store_sample_id(oss, sample_id);
-			oss << "\t";
+			oss << '\t';
 			if (header.barcode_size_bytes)
-				oss << kmer_to_string(barcode, header.barcode_len_symbols) << "\t";
-			oss << kmer_to_string(anchor, header.anchor_len_symbols) << "\t";
-			oss << kmer_to_string(target, header.target_len_symbols) << "\t";
-			oss << count << "\n";
+				oss << KmerStr(barcode, header.barcode_len_symbols) << '\t';
+			oss << KmerStr(anchor, header.anchor_len_symbols) << '\t';
+			oss << KmerStr(target, header.target_len_symbols) << '\t';
+			oss << count << '\n';
 		}
 		else if (format == RecFmt::SPLASH) {
-			oss << count << " ";
-			oss << kmer_to_string(anchor, header.anchor_len_symbols);
-			oss << kmer_to_string(target, header.target_len_symbols) << " ";
+			oss << count << ' ';
+			oss << KmerStr(anchor, header.anchor_len_symbols);
+			oss << KmerStr(target, header.target_len_symbols) << ' ';
 			sample_name_decoder.store_sample_id(oss, sample_id);
 			if (header.barcode_size_bytes)
-				oss << "_" << kmer_to_string(barcode, header.barcode_len_symbols);
+				oss << '_' << KmerStr(barcode, header.barcode_len_symbols);
 
 			oss << "\n";
 		}
@@ -556,3 +1670,78 @@ public:
 		}
 	}
 };
+
+//records decoded in bulk, without building Record objects
+//for prefix_diff records are decoded directly from the reader's buffer
+struct RecordBatch
+{
+	std::vector<uint64_t> sample_ids;
+	std::vector<uint64_t> barcodes;
+	std::vector<uint64_t> anchors;
+	std::vector<uint64_t> targets;
+	std::vector<uint64_t> counts;
+
+	size_t size() const {
+		return anchors.size();
+	}
+
+	void clear() {
+		sample_ids.clear();
+		barcodes.clear();
+		anchors.clear();
+		targets.clear();
+		counts.clear();
+	}
+
+	void get(size_t i, Record& rec) const {
+		rec.sample_id = sample_ids[i];
+		rec.barcode = barcodes[i];
+		rec.anchor = anchors[i];
+		rec.target = targets[i];
+		rec.count = counts[i];
+	}
+
+	//replaces the content with up to max_n_recs next records, false if there are no more records
+	bool load(buffered_binary_reader& in, const Header& header, size_t max_n_recs) {
+		clear();
+		if (header.encoding != RecEncoding::prefix_diff) {
+			Record rec;
+			while (size() < max_n_recs && rec.load(in, header))
+				push(rec.sample_id, rec.barcode, rec.anchor, rec.target, rec.count);
+			return size() != 0;
+		}
+
+		sample_ids.resize(max_n_recs);
+		barcodes.resize(max_n_recs);
+		anchors.resize(max_n_recs);
+		targets.resize(max_n_recs);
+		counts.resize(max_n_recs);
+
+		size_t n = 0;
+		const uint8_t* rec;
+		while (n < max_n_recs && in.start_record() && in.read_rec_compr(rec, header.rec_len)) {
+			LoadBigEndian(rec, sample_ids[n], header.sample_id_size_bytes);
+			LoadBigEndian(rec, barcodes[n], header.barcode_size_bytes);
+			LoadBigEndian(rec, anchors[n], header.anchor_size_bytes);
+			LoadBigEndian(rec, targets[n], header.target_size_bytes);
+			LoadBigEndian(rec, counts[n], header.counter_size_bytes);
+			++n;
+		}
+
+		sample_ids.resize(n);
+		barcodes.resize(n);
+		anchors.resize(n);
+		targets.resize(n);
+		counts.resize(n);
+		return n != 0;
+	}
+
+private:
+	void push(uint64_t sample_id, uint64_t barcode, uint64_t anchor, uint64_t target, uint64_t count) {
+		sample_ids.push_back(sample_id);
+		barcodes.push_back(barcode);
+		anchors.push_back(anchor);
+		targets.push_back(target);
+		counts.push_back(count);
+	}
+};
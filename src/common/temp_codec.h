@@ -0,0 +1,389 @@
+#pragma once
+#include <cstdio>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "../../libs/refresh/zstd_file.h"
+#include "../../libs/zstd/lib/zdict.h"
+#include "bin_container.h"
+
+//codec of SATC files (mainly bins, i.e., temporaries of splash), selected at runtime
+//none:      plain files, may be also stored on a RAM disk or memory mapped
+//zstd:      zstd of a given level
+//zstd_dict: zstd of a given level with a dictionary trained for the run on first blocks of a few samples (satc --train_temp_dict)
+//readers detect from the first bytes of a file whether it is compressed and whether a dictionary was used
+enum class TempCodecType { none, zstd, zstd_dict };
+
+inline TempCodecType temp_codec_from_string(const std::string& str) {
+	if (str == "none")
+		return TempCodecType::none;
+	if (str == "zstd")
+		return TempCodecType::zstd;
+	if (str == "zstd_dict")
+		return TempCodecType::zstd_dict;
+	std::cerr << "Error: unknown temp codec: " << str << "\n";
+	exit(1);
+}
+
+inline std::string to_string(TempCodecType codec) {
+	switch (codec) {
+	case TempCodecType::none:
+		return "none";
+	case TempCodecType::zstd:
+		return "zstd";
+	case TempCodecType::zstd_dict:
+		return "zstd_dict";
+	default:
+		std::cerr << "Error: unsupported temp codec, please contact authors showing this message: " << __FILE__ << ":" << __LINE__ << "\n";
+		exit(1);
+	}
+}
+
+//settings shared by all writers (and readers, they need only the dictionary)
+class TempCodec {
+	static constexpr uint32_t zstd_magic = 0xFD2FB528;
+
+	TempCodecType type = TempCodecType::zstd;
+	int level = 9;
+	std::vector<char> dict;
+	uint32_t dict_id{};
+	ZSTD_CDict* cdict{};
+	ZSTD_DDict* ddict{};
+
+	static bool read_whole_file(const std::string& path, std::vector<char>& data) {
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			return false;
+		data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		return true;
+	}
+public:
+	TempCodec() = default;
+
+	//dictionary (if dict_path is given) is used for reading with any codec, for writing only with zstd_dict
+	TempCodec(TempCodecType type, int level, const std::string& dict_path) :
+		type(type),
+		level(level) {
+		if (dict_path == "") {
+			if (type == TempCodecType::zstd_dict) {
+				std::cerr << "Error: zstd_dict temp codec requires a dictionary\n";
+				exit(1);
+			}
+			return;
+		}
+		if (!read_whole_file(dict_path, dict)) {
+			std::cerr << "Error: cannot open file " << dict_path << "\n";
+			exit(1);
+		}
+		dict_id = ZDICT_getDictID(dict.data(), dict.size());
+		if (!dict_id) {
+			std::cerr << "Error: " << dict_path << " is not a zstd dictionary\n";
+			exit(1);
+		}
+		if (type == TempCodecType::zstd_dict)
+			cdict = ZSTD_createCDict(dict.data(), dict.size(), level);
+		ddict = ZSTD_createDDict(dict.data(), dict.size());
+	}
+
+	TempCodec(const TempCodec&) = delete;
+	TempCodec& operator=(const TempCodec&) = delete;
+
+	~TempCodec() {
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+	}
+
+	//zstd level 9, the codec used before it was configurable
+	static const TempCodec& Default() {
+		static TempCodec codec;
+		return codec;
+	}
+
+	TempCodecType GetType() const {
+		return type;
+	}
+
+	int GetLevel() const {
+		return level;
+	}
+
+	const ZSTD_CDict* GetCDict() const {
+		return cdict;
+	}
+
+	//for a file compressed with dictionary of a given id, exits if there is no such dictionary
+	const ZSTD_DDict* GetDDict(uint32_t id, const std::string& path) const {
+		if (id == 0)
+			return nullptr;
+		if (id != dict_id) {
+			std::cerr << "Error: " << path << " was compressed with a dictionary (id: " << id << ") that was not given (--temp_dict)\n";
+			exit(1);
+		}
+		return ddict;
+	}
+
+	//compressed: false for plain files, dict_id: 0 if no dictionary was used
+	//offset: start of the SATC file (e.g. of a bin in a container)
+	static void DetectFile(const std::string& path, bool& compressed, uint32_t& dict_id, uint64_t offset = 0) {
+		compressed = false;
+		dict_id = 0;
+		FILE* f = fopen(path.c_str(), "rb");
+		if (!f)
+			return;
+		uint8_t buf[18]; //max zstd frame header size
+		size_t n = 0;
+		if (!bin_container_fseek(f, offset))
+			n = fread(buf, 1, sizeof(buf), f);
+		fclose(f);
+		//the first byte of not compressed SATC is at most 8 or 0xFF (see Header), so it never starts with zstd magic
+		if (n < 4 || (buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24)) != zstd_magic)
+			return;
+		compressed = true;
+		dict_id = ZSTD_getDictID_fromFrame(buf, n);
+	}
+
+	//samples are concatenated, for little data the dictionary is smaller, false if there is too little data even for the smallest one
+	static bool TrainDictionary(const std::vector<uint8_t>& samples, const std::vector<size_t>& sample_sizes, const std::string& out_path, size_t dict_size = 112640) {
+		//zstd requires more training data than the dictionary size
+		dict_size = std::max<size_t>(std::min(dict_size, samples.size() / 8), 256);
+		std::vector<char> dict(dict_size);
+		auto res = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples.data(), sample_sizes.data(), static_cast<unsigned>(sample_sizes.size()));
+		if (ZDICT_isError(res)) {
+			std::cerr << "Warning: cannot train dictionary: " << ZDICT_getErrorName(res) << "\n";
+			return false;
+		}
+
+		std::ofstream out(out_path, std::ios::binary);
+		if (!out) {
+			std::cerr << "Error: cannot open file " << out_path << "\n";
+			exit(1);
+		}
+		out.write(dict.data(), res);
+		return true;
+	}
+};
+
+//writes a single file with a given codec, or a bin of a container
+class temp_file_writer {
+	refresh::zstd_file zout;
+	FILE* raw{};
+	BinContainerWriter* container{};
+	uint32_t bin_id{};
+	bool compressed = true;
+	size_t io_buffer_size = 1ull << 20;
+
+	bool open_raw(const std::string& path) {
+		raw = fopen(path.c_str(), "wb");
+		if (!raw)
+			return false;
+		setvbuf(raw, nullptr, _IOFBF, io_buffer_size);
+		return true;
+	}
+
+	void write_raw_out(const char* p, size_t size) {
+		if (container)
+			container->buffer(bin_id).insert(container->buffer(bin_id).end(), p, p + size);
+		else
+			fwrite(p, 1, size, raw);
+	}
+
+	void spill_if_needed() {
+		if (container)
+			container->spill_if_needed(bin_id);
+	}
+public:
+	explicit temp_file_writer(const TempCodec& codec = TempCodec::Default()) :
+		zout(codec.GetLevel()),
+		compressed(codec.GetType() != TempCodecType::none) {
+		zout.set_cdict(codec.GetCDict());
+	}
+
+	temp_file_writer(temp_file_writer&& rhs) noexcept :
+		zout(std::move(rhs.zout)),
+		raw(rhs.raw),
+		container(rhs.container),
+		bin_id(rhs.bin_id),
+		compressed(rhs.compressed) {
+		rhs.raw = nullptr;
+		rhs.container = nullptr;
+	}
+
+	temp_file_writer& operator=(temp_file_writer&& rhs) noexcept {
+		close();
+		zout = std::move(rhs.zout);
+		raw = rhs.raw;
+		container = rhs.container;
+		bin_id = rhs.bin_id;
+		compressed = rhs.compressed;
+		rhs.raw = nullptr;
+		rhs.container = nullptr;
+		return *this;
+	}
+
+	~temp_file_writer() {
+		close();
+	}
+
+	bool open(const std::string& path) {
+		return compressed ? zout.open_writing(path) : open_raw(path);
+	}
+
+	//bin of a container, which must live until the writer is closed (or reopened)
+	bool open(BinContainerWriter& container, uint32_t bin_id) {
+		this->container = &container;
+		this->bin_id = bin_id;
+		return compressed ? zout.open_writing(container.buffer(bin_id)) : true;
+	}
+
+	//compression context and buffers are reused
+	bool reopen(const std::string& path) {
+		if (compressed)
+			return zout.reopen_writing(path);
+		close();
+		return open_raw(path);
+	}
+
+	bool reopen(BinContainerWriter& container, uint32_t bin_id) {
+		if (compressed) {
+			this->container = &container;
+			this->bin_id = bin_id;
+			return zout.reopen_writing(container.buffer(bin_id));
+		}
+		close();
+		return open(container, bin_id);
+	}
+
+	bool is_open() const {
+		return compressed ? zout.is_opened_for_writing() : raw != nullptr || container != nullptr;
+	}
+
+	bool is_compressed() const {
+		return compressed;
+	}
+
+	void write(const char* p, size_t size) {
+		if (compressed)
+			zout.write(const_cast<char*>(p), size);
+		else
+			write_raw_out(p, size);
+		spill_if_needed();
+	}
+
+	//data written later may be read independently (starts a new zstd frame)
+	void end_frame() {
+		if (compressed)
+			zout.end_frame();
+		spill_if_needed();
+	}
+
+	//position in the file, just after end_frame() it is the start of the next frame
+	uint64_t tell() {
+		if (container)
+			return container->tell(bin_id);
+		if (compressed)
+			return zout.tell();
+#ifdef _WIN32
+		return static_cast<uint64_t>(_ftelli64(raw));
+#else
+		return static_cast<uint64_t>(ftello(raw));
+#endif
+	}
+
+	//stored as is, only just after end_frame()
+	void write_raw(const char* p, size_t size) {
+		if (compressed)
+			zout.write_raw(p, size);
+		else
+			write_raw_out(p, size);
+		spill_if_needed();
+	}
+
+	void close() {
+		if (compressed)
+			zout.close();
+		else if (raw) {
+			fclose(raw);
+			raw = nullptr;
+		}
+		container = nullptr;
+	}
+};
+
+//reads a single file (or its part, e.g. a bin in a container), codec is detected from the file
+//offsets are relative to the start of the part
+class temp_file_reader {
+	refresh::zstd_file zin;
+	FILE* raw{};
+	bool compressed = true;
+	uint64_t raw_pos{};
+	uint64_t raw_end = UINT64_MAX;
+	uint64_t base{};
+public:
+	temp_file_reader(size_t io_buffer_size, size_t zstd_buffer_size) :
+		zin(9, io_buffer_size, zstd_buffer_size) {
+	}
+
+	~temp_file_reader() {
+		close();
+	}
+
+	//size: of the part starting at offset, if the part is the whole file it may be UINT64_MAX
+	bool open(const std::string& path, const TempCodec& codec = TempCodec::Default(), uint64_t offset = 0, uint64_t size = UINT64_MAX) {
+		uint32_t dict_id;
+		TempCodec::DetectFile(path, compressed, dict_id, offset);
+		base = offset;
+		if (compressed) {
+			zin.set_ddict(codec.GetDDict(dict_id, path));
+			if (!zin.open_reading(path))
+				return false;
+			return offset == 0 && size == UINT64_MAX ? true : zin.seek_reading(offset, offset + size);
+		}
+		raw = fopen(path.c_str(), "rb");
+		if (!raw)
+			return false;
+		raw_pos = 0;
+		raw_end = UINT64_MAX;
+		return offset == 0 && size == UINT64_MAX ? true : seek_reading(0, size);
+	}
+
+	bool is_open() const {
+		return compressed ? zin.is_opened_for_reading() : raw != nullptr;
+	}
+
+	bool is_compressed() const {
+		return compressed;
+	}
+
+	size_t read(char* p, size_t size) {
+		if (compressed)
+			return zin.read(p, size);
+		size = static_cast<size_t>(std::min<uint64_t>(size, raw_end - raw_pos));
+		size_t readed = fread(p, 1, size, raw);
+		raw_pos += readed;
+		return readed;
+	}
+
+	//continue reading from offset (start of a frame) up to end_offset
+	bool seek_reading(uint64_t offset, uint64_t end_offset) {
+		if (compressed)
+			return zin.seek_reading(base + offset, base + end_offset);
+		if (bin_container_fseek(raw, base + offset))
+			return false;
+		raw_pos = offset;
+		raw_end = end_offset;
+		return true;
+	}
+
+	void close() {
+		if (compressed)
+			zin.close();
+		else if (raw) {
+			fclose(raw);
+			raw = nullptr;
+		}
+	}
+};
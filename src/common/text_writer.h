@@ -0,0 +1,120 @@
+#pragma once
+#include <ostream>
+#include <vector>
+#include <string>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <cinttypes>
+#include <type_traits>
+
+//packed k-mer (2 bits per symbol, the first symbol at the highest bits) to be printed as ACGT
+struct KmerStr {
+	uint64_t kmer;
+	uint32_t len;
+	KmerStr(uint64_t kmer, uint32_t len) : kmer(kmer), len(len) {}
+};
+
+//4 symbols of a byte of packed k-mer
+inline const std::array<std::array<char, 4>, 256>& kmer_byte_lut() {
+	static const auto lut = [] {
+		std::array<std::array<char, 4>, 256> res{};
+		for (uint32_t b = 0; b < 256; ++b)
+			for (uint32_t i = 0; i < 4; ++i)
+				res[b][i] = "ACGT"[(b >> (6 - 2 * i)) & 3];
+		return res;
+	}();
+	return lut;
+}
+
+//dst must have space for len symbols
+inline void decode_kmer(uint64_t kmer, uint32_t len, char* dst) {
+	const auto& lut = kmer_byte_lut();
+	uint32_t i = len;
+	for (; i >= 4; i -= 4, kmer >>= 8)
+		memcpy(dst + i - 4, lut[kmer & 0xff].data(), 4);
+	for (; i > 0; --i, kmer >>= 2)
+		dst[i - 1] = "ACGT"[kmer & 3];
+}
+
+inline std::ostream& operator<<(std::ostream& oss, const KmerStr& x) {
+	char buf[64];
+	decode_kmer(x.kmer, x.len, buf);
+	return oss.write(buf, x.len);
+}
+
+//text output through a large buffer, much faster than std::ostream << for each field
+//numbers are formatted with std::to_chars, floating point the same as std::ostream default (%g, precision 6)
+//the stream must not be written directly while TextWriter is in use (it may be after flush())
+class TextWriter {
+	std::ostream& out;
+	std::vector<char> buff;
+	size_t pos{};
+
+	static constexpr size_t max_number_len = 64;
+
+	char* reserve(size_t n) {
+		if (pos + n > buff.size()) {
+			flush();
+			if (n > buff.size())
+				buff.resize(n);
+		}
+		return buff.data() + pos;
+	}
+public:
+	explicit TextWriter(std::ostream& out, size_t buff_size = 1ull << 20) :
+		out(out),
+		buff(buff_size) {
+	}
+
+	TextWriter(const TextWriter&) = delete;
+	TextWriter& operator=(const TextWriter&) = delete;
+
+	~TextWriter() {
+		flush();
+	}
+
+	void flush() {
+		if (pos)
+			out.write(buff.data(), pos);
+		pos = 0;
+	}
+
+	TextWriter& operator<<(char c) {
+		*reserve(1) = c;
+		++pos;
+		return *this;
+	}
+
+	TextWriter& operator<<(const char* str) {
+		size_t len = strlen(str);
+		memcpy(reserve(len), str, len);
+		pos += len;
+		return *this;
+	}
+
+	TextWriter& operator<<(const std::string& str) {
+		memcpy(reserve(str.size()), str.data(), str.size());
+		pos += str.size();
+		return *this;
+	}
+
+	TextWriter& operator<<(const KmerStr& x) {
+		decode_kmer(x.kmer, x.len, reserve(x.len));
+		pos += x.len;
+		return *this;
+	}
+
+	template<typename T, typename std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char> && !std::is_same_v<T, bool>, int> = 0>
+	TextWriter& operator<<(T x) {
+		char* p = reserve(max_number_len);
+		pos = std::to_chars(p, p + max_number_len, x).ptr - buff.data();
+		return *this;
+	}
+
+	TextWriter& operator<<(double x) {
+		char* p = reserve(max_number_len);
+		pos = std::to_chars(p, p + max_number_len, x, std::chars_format::general, 6).ptr - buff.data();
+		return *this;
+	}
+};
@@ -0,0 +1,200 @@
+#include "reads_counter.h"
+#include "../common/murmur64.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "zlib.h"
+
+namespace {
+	//gzread works also for not compressed files
+	class LineReader {
+		gzFile in;
+		std::vector<char> buff;
+		size_t pos{};
+		size_t size{};
+
+		bool refill() {
+			auto readed = gzread(in, buff.data(), static_cast<unsigned>(buff.size()));
+			if (readed <= 0)
+				return false;
+			size = static_cast<size_t>(readed);
+			pos = 0;
+			return true;
+		}
+	public:
+		LineReader(gzFile in, size_t buff_size = 1ull << 24) :
+			in(in),
+			buff(buff_size) {
+		}
+
+		//line without trailing '\n' and '\r'
+		bool GetLine(std::string& line) {
+			line.clear();
+			bool any = false;
+			while (true) {
+				if (pos == size && !refill())
+					break;
+				any = true;
+				auto start = buff.data() + pos;
+				auto end = static_cast<char*>(memchr(start, '\n', size - pos));
+				if (end) {
+					line.append(start, end);
+					pos += end - start + 1;
+					break;
+				}
+				line.append(start, buff.data() + size);
+				pos = size;
+			}
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			return any;
+		}
+	};
+
+	const uint8_t invalid_symb = 4;
+	const auto symb_code = []() {
+		std::vector<uint8_t> res(256, invalid_symb);
+		res['A'] = res['a'] = 0;
+		res['C'] = res['c'] = 1;
+		res['G'] = res['g'] = 2;
+		res['T'] = res['t'] = 3;
+		return res;
+	}();
+}
+
+ReadsCounter::ReadsCounter(uint32_t anchor_len, uint32_t gap_len, uint32_t target_len, uint64_t n_bins, uint64_t max_count, const AcceptedAnchors* accepted_anchors) :
+	anchor_len(anchor_len),
+	gap_len(gap_len),
+	target_len(target_len),
+	max_count(max_count),
+	accepted_anchors(accepted_anchors),
+	anchor_mask(((1ull << anchor_len) << anchor_len) - 1), //I shift twice because len may be 32...
+	target_mask(((1ull << target_len) << target_len) - 1),
+	bins(n_bins),
+	compact_at(n_bins, min_compact_size) {
+}
+
+void ReadsCounter::compact(uint64_t bin_id) {
+	auto& bin = bins[bin_id];
+	if (bin.empty())
+		return;
+
+	std::sort(bin.begin(), bin.end(), [](const AnchorTargetCount& e1, const AnchorTargetCount& e2) {
+		if (e1.anchor != e2.anchor)
+			return e1.anchor < e2.anchor;
+		return e1.target < e2.target;
+	});
+
+	size_t out = 0;
+	for (size_t i = 1; i < bin.size(); ++i) {
+		if (bin[i].anchor == bin[out].anchor && bin[i].target == bin[out].target)
+			bin[out].count = std::min(bin[out].count + bin[i].count, max_count);
+		else
+			bin[++out] = bin[i];
+	}
+	bin.resize(out + 1);
+
+	compact_at[bin_id] = std::max(min_compact_size, 2 * bin.size());
+}
+
+void ReadsCounter::process_seq(const char* seq, size_t len, std::vector<uint64_t>& anchors) {
+	const uint64_t kmer_len = anchor_len + gap_len + target_len;
+	if (len < kmer_len)
+		return;
+
+	const uint64_t n_bins = bins.size();
+
+	anchors.resize(len);
+	uint64_t anchor = 0;
+	uint64_t target = 0;
+	int64_t last_invalid = -1;
+
+	for (size_t i = 0; i < len; ++i) {
+		auto c = symb_code[static_cast<uint8_t>(seq[i])];
+		if (c == invalid_symb) {
+			last_invalid = i;
+			c = 0;
+		}
+		anchor = ((anchor << 2) + c) & anchor_mask;
+		target = ((target << 2) + c) & target_mask;
+		anchors[i] = anchor;
+
+		if (i + 1 < kmer_len)
+			continue;
+
+		int64_t kmer_start = i + 1 - kmer_len;
+		if (last_invalid >= kmer_start)
+			continue;
+
+		uint64_t cur_anchor = anchors[kmer_start + anchor_len - 1];
+		if (accepted_anchors && !accepted_anchors->IsAccepted(cur_anchor))
+			continue;
+		uint64_t bin_id = MurMur64Hash{}(cur_anchor) % n_bins;
+		auto& bin = bins[bin_id];
+		bin.push_back({ cur_anchor, target, 1 });
+		++tot_pairs;
+
+		if (bin.size() >= compact_at[bin_id])
+			compact(bin_id);
+	}
+}
+
+bool ReadsCounter::ProcessFile(const std::string& path, input_format_t input_format) {
+	gzFile in = gzopen(path.c_str(), "r");
+	if (!in)
+		return false;
+	gzbuffer(in, 1 << 24);
+
+	LineReader reader(in);
+	std::string line;
+	std::string seq;
+	std::vector<uint64_t> anchors;
+
+	if (input_format == input_format_t::fastq) {
+		while (reader.GetLine(line)) {
+			if (line.empty())
+				continue;
+			if (!reader.GetLine(seq)) {
+				std::cerr << "Warning: truncated FASTQ record in " << path << "\n";
+				break;
+			}
+			process_seq(seq.data(), seq.size(), anchors);
+			++tot_reads;
+			reader.GetLine(line); // +
+			reader.GetLine(line); // qualities
+		}
+	}
+	else if (input_format == input_format_t::fasta) {
+		bool in_record = false;
+		while (reader.GetLine(line)) {
+			if (!line.empty() && line[0] == '>') {
+				if (in_record) {
+					process_seq(seq.data(), seq.size(), anchors);
+					++tot_reads;
+				}
+				in_record = true;
+				seq.clear();
+			}
+			else
+				seq += line;
+		}
+		if (in_record) {
+			process_seq(seq.data(), seq.size(), anchors);
+			++tot_reads;
+		}
+	}
+	else {
+		std::cerr << "Error: unsupported input format: " << to_string(input_format) << "\n";
+		exit(1);
+	}
+
+	gzclose(in);
+	return true;
+}
+
+void ReadsCounter::GetBin(uint64_t bin_id, std::vector<AnchorTargetCount>& res) {
+	compact(bin_id);
+	res.clear();
+	res.shrink_to_fit();
+	std::swap(res, bins[bin_id]);
+}
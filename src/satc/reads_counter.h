@@ -0,0 +1,58 @@
+#ifndef _READS_COUNTER_H
+#define _READS_COUNTER_H
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include "../common/common_types.h"
+#include "../common/accepted_anchors.h"
+
+//counts (anchor, target) pairs directly from FASTQ/FASTA reads (gzipped or not)
+//pairs are partitioned into bins by MurMur64Hash(anchor) % n_bins while reading
+//each bin is periodically sorted and compacted, so its memory is proportional to the number of unique pairs
+class ReadsCounter
+{
+public:
+	struct AnchorTargetCount {
+		uint64_t anchor;
+		uint64_t target;
+		uint64_t count;
+	};
+
+private:
+	uint32_t anchor_len;
+	uint32_t gap_len;
+	uint32_t target_len;
+	uint64_t max_count;
+
+	const AcceptedAnchors* accepted_anchors; //nullptr means all anchors are accepted
+
+	uint64_t anchor_mask;
+	uint64_t target_mask;
+
+	std::vector<std::vector<AnchorTargetCount>> bins;
+	std::vector<size_t> compact_at; //when the bin reaches this size it will be compacted
+
+	uint64_t tot_reads{};
+	uint64_t tot_pairs{};
+
+	static const size_t min_compact_size = 1ull << 16;
+
+	void compact(uint64_t bin_id);
+	void process_seq(const char* seq, size_t len, std::vector<uint64_t>& anchors);
+
+public:
+	//pairs of not accepted anchors are dropped while reading, so they are never counted
+	ReadsCounter(uint32_t anchor_len, uint32_t gap_len, uint32_t target_len, uint64_t n_bins, uint64_t max_count, const AcceptedAnchors* accepted_anchors = nullptr);
+
+	//returns false if the file cannot be opened
+	bool ProcessFile(const std::string& path, input_format_t input_format);
+
+	//sorted by (anchor, target), each pair occurs once, the content of the bin is released
+	void GetBin(uint64_t bin_id, std::vector<AnchorTargetCount>& res);
+
+	uint64_t GetNReads() const { return tot_reads; }
+	uint64_t GetNPairs() const { return tot_pairs; }
+};
+
+#endif //_READS_COUNTER_H
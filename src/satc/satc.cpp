@@ -2,7 +2,13 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <sstream>
+#include <atomic>
+#include <memory>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "../common/version.h"
 #include "../common/kmc_api/kmer_api.h"
 #include "../common/kmc_api/kmc_file.h"
@@ -13,9 +19,40 @@
 #include "../common/hamming_filter.h"
 #include "../common/illumina_adapters_static.h"
 #include "../common/target_count.h"
+#include "../common/anchor_sketch.h"
+#include "../common/accepted_anchors.h"
+#include "reads_counter.h"
+
+enum class InputType { kmc, fastq, fasta };
+
+inline InputType input_type_from_string(const std::string& str) {
+	if (str == "kmc")
+		return InputType::kmc;
+	if (str == "fq" || str == "fastq")
+		return InputType::fastq;
+	if (str == "fa" || str == "fasta")
+		return InputType::fasta;
+	std::cerr << "Error: unknown input format: " << str << "\n";
+	exit(1);
+}
+
+inline std::string to_string(InputType input_type) {
+	switch (input_type) {
+	case InputType::kmc:
+		return "kmc";
+	case InputType::fastq:
+		return "fastq";
+	case InputType::fasta:
+		return "fasta";
+	default:
+		std::cerr << "Error: unsupported input type, please contact authors showing this message: " << __FILE__ << ":" << __LINE__ << "\n";
+		exit(1);
+	}
+}
 
 struct SampleDesc
 {
+	std::string out_base;
 	std::string input_kmc_db_path;
 	uint64_t sample_id;
 };
@@ -25,53 +62,145 @@ struct Params
 	SampleDesc input_sample;
 	uint64_t anchor_len{};
 	uint64_t target_len{};
+	uint64_t gap_len{}; //only for reads input, for kmc input it is inferred from k-mer len
+	InputType input_format = InputType::kmc;
 	uint64_t n_bins{};
+	uint32_t n_threads = 1;
+	std::string batch; //if set samples are read from this file instead of positional params
+	uint32_t n_parallel_samples = 1;
+	uint32_t n_compression_threads = 0; //0 means output is compressed by the thread producing it
+	RecEncoding rec_encoding = RecEncoding::prefix_diff;
+	bool indexed = false;
+	bool bins_container = false; //if set all bins of a sample are stored in <outbase>.bins
+	bool bin_stats = false;
+	TempCodecType temp_codec = TempCodecType::zstd;
+	int temp_codec_level = 9;
+	std::string temp_dict;
+	std::vector<SampleDesc> batch_samples;
+	bool build_sketch = false; //if set <outbase>.sketch is created instead of bins
+	uint32_t sketch_depth = 4;
+	uint32_t sketch_width_log2 = 22;
+	std::string cohort_sketch;
+	uint64_t cohort_anchor_count_threshold{};
+	uint64_t cohort_anchor_unique_targets_threshold{};
+	uint64_t cohort_anchor_samples_threshold{};
 	uint64_t anchor_sample_counts_threshold{}; //keep only anchors with counts > anchor_sample_counts_threshold
 	uint64_t poly_ACGT_len{};
 	uint64_t min_hamming_threshold{};
 	std::string artifacts;
+	std::string anchor_list;
 	bool dont_filter_illumina_adapters = false;
 	std::string out_base;
 	void Print(std::ostream& oss) const
 	{
 		oss << "anchor len                     : " << anchor_len << "\n";
 		oss << "target len                     : " << target_len << "\n";
+		oss << "input format                   : " << to_string(input_format) << "\n";
+		if (input_format != InputType::kmc)
+			oss << "gap len                        : " << gap_len << "\n";
 		oss << "n bins                         : " << n_bins << "\n";
-		oss << "outbase                        : " << out_base << "\n";
+		oss << "n threads                      : " << n_threads << "\n";
+		oss << "n compression threads          : " << n_compression_threads << "\n";
+		oss << "record encoding                : " << to_string(rec_encoding) << "\n";
+		oss << "indexed                        : " << std::boolalpha << indexed << "\n";
+		oss << "bins container                 : " << std::boolalpha << bins_container << "\n";
+		oss << "bin stats                      : " << std::boolalpha << bin_stats << "\n";
+		oss << "temp codec                     : " << to_string(temp_codec);
+		if (temp_codec != TempCodecType::none)
+			oss << " (level " << temp_codec_level << ")";
+		if (temp_codec == TempCodecType::zstd_dict)
+			oss << " " << temp_dict;
+		oss << "\n";
+		if (!batch.empty()) {
+			oss << "batch                          : " << batch << " (" << batch_samples.size() << " samples)\n";
+			oss << "n parallel samples             : " << n_parallel_samples << "\n";
+		}
+		else
+			oss << "outbase                        : " << out_base << "\n";
 		oss << "anchor_sample_counts_threshold : " << anchor_sample_counts_threshold << "\n";
 		oss << "poly_ACGT_len                  : " << poly_ACGT_len << "\n";
 		oss << "artifacts                      : " << artifacts << "\n";
+		oss << "anchor_list                    : " << anchor_list << "\n";
 		oss << "dont_filter_illumina_adapters  : " << std::boolalpha << dont_filter_illumina_adapters << "\n";
 		oss << "min_hamming_threshold          : " << min_hamming_threshold << "\n";
-		oss << "input sample                   : " << input_sample.input_kmc_db_path << " " << input_sample.sample_id << "\n";
+		if (build_sketch)
+			oss << "build sketch                   : " << sketch_depth << " x 2^" << sketch_width_log2 << "\n";
+		if (!cohort_sketch.empty()) {
+			oss << "cohort sketch                  : " << cohort_sketch << "\n";
+			oss << "cohort thresholds (cnt/trg/smp): " << cohort_anchor_count_threshold << " " << cohort_anchor_unique_targets_threshold << " " << cohort_anchor_samples_threshold << "\n";
+		}
+		if (batch.empty())
+			oss << "input sample                   : " << input_sample.input_kmc_db_path << " " << input_sample.sample_id << "\n";
 	}
 	static void Usage(char* prog_name) {
 		std::cerr << "satc (sample anchor target count)\n";
 		SPLASH_VER_PRINT(std::cerr);
 		std::cerr << "Usage: \n\t" << prog_name << " [options] <outbase> <input_path> <input_id>\n";
+		std::cerr << "or\n";
+		std::cerr << "\t" << prog_name << " [options] --batch <path>\n";
+		std::cerr << "or\n";
+		std::cerr << "\t" << prog_name << " --merge_sketches <output> <input_list>\n";
+		std::cerr << "or\n";
+		std::cerr << "\t" << prog_name << " --train_temp_dict <output> <input_list>\n";
 		std::cerr
 			<< "Positional parameters:\n"
-			<< "    <outbase>    - base name of output (will be extended with \".{bin_id}.bin\" \n"
-			<< "    <input_path> - path to sorted (kmc1 format) kmc database\n"
+			<< "    <outbase>    - base name of output (will be extended with \".{bin_id}.bin\" or with \".bins\" if --bins_container is used)\n"
+			<< "    <input_path> - path to sorted (kmc1 format) kmc database or to FASTQ/FASTA file (gzipped or not) if --input_format is fq/fa\n"
 			<< "    <input_id>   - id stored with each record\n";
 		std::cerr
 			<< "Options:\n"
 			<< "    --anchor_len <int> - anchor len\n"
 			<< "    --target_len <int> - target len\n"
+			<< "    --gap_len <int> - gap len (only for fq/fa input, for kmc input it is inferred from k-mer len) (default: 0)\n"
+			<< "    --input_format <kmc|fq|fa> - input format, for fq/fa anchor-target pairs are counted directly from reads without kmc (default: kmc)\n"
 			<< "    --n_bins <int> - number of output bins\n"
+			<< "    --n_threads <int> - number of threads, kmc db is split into ranges of prefixes processed in parallel (default: 1)\n"
+			<< "    --batch <path> - process many samples in a single run, each line of the file is: <outbase> <input_path> <input_id>\n"
+			<< "    --n_parallel_samples <int> - number of samples from --batch processed concurrently, each uses --n_threads threads (default: 1)\n"
+			<< "    --n_compression_threads <int> - number of threads compressing output bins in the background, 0 means compression in the main thread (default: 0)\n"
+			<< "    --rec_encoding <prefix_diff|bit_packed|columnar> - encoding of output records, bit_packed and columnar are more compact but not readable by older versions, columnar groups records in blocks and stores each field separately (default: prefix_diff)\n"
+			<< "    --indexed - store bins in indexed layout (blocks starting at anchor boundaries and index of blocks at the end), so readers with anchor list may skip not needed blocks, not readable by older versions\n"
+			<< "    --bin_stats - store statistics of records (number of records and anchors, histogram of records per anchor, etc.) at the end of each bin, not readable by older versions\n"
+			<< "    --bins_container - store all bins of a sample in a single file <outbase>.bins, bin i is read (by satc_merge, satc_dump) as <outbase>.bins:i\n"
+			<< "    --temp_codec <none|zstd|zstd_dict> - compression of output bins, none is the fastest (e.g. for fast local disks or RAM disk), zstd_dict is the most compact (default: zstd)\n"
+			<< "    --temp_codec_level <int> - zstd compression level (default: 9)\n"
+			<< "    --temp_dict <path> - zstd dictionary for zstd_dict codec (see --train_temp_dict)\n"
 			<< "    --poly_ACGT_len <int> - all anchors containing polyACGT of this length will be filtered out (0 means no filtering)\n"
 			<< "    --artifacts <string> - path to artifacts, each anchor containing artifact will be filtered out\n"
+			<< "    --anchor_list <string> - path to text file containing anchors separated by whitespaces, only anchors from this file will be stored\n"
 			<< "    --dont_filter_illumina_adapters - if used anchors containing Illumina adapters will not be filtered out\n"
 			<< "    --anchor_sample_counts_threshold <int> - keep only anchors with counts > anchor_sample_counts_threshold\n"
-			<< "    --min_hamming_threshold <int> - keep only anchors with a pair of targets that differ by >= min_hamming_threshold\n";
+			<< "    --min_hamming_threshold <int> - keep only anchors with a pair of targets that differ by >= min_hamming_threshold\n"
+			<< "Cohort pre-screen (first pass builds per sample sketches, they are merged, second pass drops anchors that will not pass satc_merge filters):\n"
+			<< "    --build_sketch - instead of bins store <outbase>.sketch with anchor statistics\n"
+			<< "    --sketch_depth <int> - number of rows of the sketch (default: 4)\n"
+			<< "    --sketch_width_log2 <int> - log2 of the number of columns of the sketch (default: 22)\n"
+			<< "    --cohort_sketch <path> - merged sketch of all samples (--merge_sketches), anchors that do not pass thresholds below are not stored\n"
+			<< "    --cohort_anchor_count_threshold <int> - the same as satc_merge --anchor_count_threshold (default: 0)\n"
+			<< "    --cohort_anchor_unique_targets_threshold <int> - the same as satc_merge --anchor_unique_targets_threshold (default: 0)\n"
+			<< "    --cohort_anchor_samples_threshold <int> - the same as satc_merge --anchor_samples_threshold (default: 0)\n"
+			<< "    --merge_sketches <output> <input_list> - merge sketches listed (one per line) in <input_list> into <output>\n"
+			<< "Temp dictionary:\n"
+			<< "    --train_temp_dict <output> <input_list> - train zstd dictionary for --temp_codec zstd_dict on first blocks of bins listed (one per line) in <input_list>, nothing is stored if there is too little data\n";
 	}
 };
 
+//see AnchorSketch
+struct CohortPrescreen {
+	AnchorSketch* sketch_out = nullptr; //if set anchors passing all filters are only added to the sketch, nothing is stored
+	const AnchorSketch* sketch_in = nullptr;
+	uint64_t anchor_count_threshold{};
+	uint64_t anchor_unique_targets_threshold{};
+	uint64_t anchor_samples_threshold{};
+};
+
 struct Stats {
 	uint64_t tot_poly_filtered_out{};
 	uint64_t tot_artifacts_filtered_out{};
 	uint64_t tot_hamming_distance_filtered_out{};
 	uint64_t tot_cnt_threshold_filtered_out{};
+	uint64_t tot_cohort_filtered_out{};
+	uint64_t tot_anchor_list_filtered_out{};
 	uint64_t tot_unique_anchors{};
 	uint64_t tot_out_recs{};
 	uint64_t tot_in_recs{};
@@ -81,12 +210,40 @@ struct Stats {
 		oss << "# artifacts filtered anchors	       : " << tot_artifacts_filtered_out << "\n";
 		oss << "# hamming distance filtered anchors    : " << tot_hamming_distance_filtered_out << "\n";
 		oss << "# filtered cnt threshold anchors       : " << tot_cnt_threshold_filtered_out << "\n";
+		oss << "# cohort pre-screen filtered anchors   : " << tot_cohort_filtered_out << "\n";
+		oss << "# anchor list filtered anchors         : " << tot_anchor_list_filtered_out << "\n";
 		oss << "# unique anchors                       : " << tot_unique_anchors << "\n";
 		oss << "# out recs                             : " << tot_out_recs << "\n";
 		oss << "# in recs                              : " << tot_in_recs << "\n";
 	}
 };
 
+std::vector<SampleDesc> read_batch(const std::string& path) {
+	std::ifstream in(path);
+	if (!in) {
+		std::cerr << "Error: cannot open file " << path << "\n";
+		exit(1);
+	}
+	std::vector<SampleDesc> res;
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream iss(line);
+		SampleDesc sample;
+		if (!(iss >> sample.out_base))
+			continue;
+		if (!(iss >> sample.input_kmc_db_path >> sample.sample_id)) {
+			std::cerr << "Error: wrong line in " << path << ": " << line << "\n";
+			exit(1);
+		}
+		res.push_back(std::move(sample));
+	}
+	if (res.empty()) {
+		std::cerr << "Error: no samples in " << path << "\n";
+		exit(1);
+	}
+	return res;
+}
+
 Params read_params(int argc, char** argv)
 {
 	Params res;
@@ -106,6 +263,60 @@ Params read_params(int argc, char** argv)
 			std::string tmp = argv[++i];
 			res.n_bins = std::stoull(tmp);
 		}
+		else if (param == "--n_threads") {
+			std::string tmp = argv[++i];
+			res.n_threads = std::stoul(tmp);
+		}
+		else if (param == "--batch")
+			res.batch = argv[++i];
+		else if (param == "--n_parallel_samples") {
+			std::string tmp = argv[++i];
+			res.n_parallel_samples = std::stoul(tmp);
+		}
+		else if (param == "--n_compression_threads") {
+			std::string tmp = argv[++i];
+			res.n_compression_threads = std::stoul(tmp);
+		}
+		else if (param == "--rec_encoding")
+			res.rec_encoding = rec_encoding_from_string(argv[++i]);
+		else if (param == "--indexed")
+			res.indexed = true;
+		else if (param == "--bins_container")
+			res.bins_container = true;
+		else if (param == "--bin_stats")
+			res.bin_stats = true;
+		else if (param == "--temp_codec")
+			res.temp_codec = temp_codec_from_string(argv[++i]);
+		else if (param == "--temp_codec_level") {
+			std::string tmp = argv[++i];
+			res.temp_codec_level = std::stoi(tmp);
+		}
+		else if (param == "--temp_dict")
+			res.temp_dict = argv[++i];
+		else if (param == "--build_sketch")
+			res.build_sketch = true;
+		else if (param == "--sketch_depth") {
+			std::string tmp = argv[++i];
+			res.sketch_depth = std::stoul(tmp);
+		}
+		else if (param == "--sketch_width_log2") {
+			std::string tmp = argv[++i];
+			res.sketch_width_log2 = std::stoul(tmp);
+		}
+		else if (param == "--cohort_sketch")
+			res.cohort_sketch = argv[++i];
+		else if (param == "--cohort_anchor_count_threshold") {
+			std::string tmp = argv[++i];
+			res.cohort_anchor_count_threshold = std::stoull(tmp);
+		}
+		else if (param == "--cohort_anchor_unique_targets_threshold") {
+			std::string tmp = argv[++i];
+			res.cohort_anchor_unique_targets_threshold = std::stoull(tmp);
+		}
+		else if (param == "--cohort_anchor_samples_threshold") {
+			std::string tmp = argv[++i];
+			res.cohort_anchor_samples_threshold = std::stoull(tmp);
+		}
 		else if (param == "--anchor_len") {
 			std::string tmp = argv[++i];
 			res.anchor_len = std::stoull(tmp);
@@ -114,6 +325,12 @@ Params read_params(int argc, char** argv)
 			std::string tmp = argv[++i];
 			res.target_len = std::stoull(tmp);
 		}
+		else if (param == "--gap_len") {
+			std::string tmp = argv[++i];
+			res.gap_len = std::stoull(tmp);
+		}
+		else if (param == "--input_format")
+			res.input_format = input_type_from_string(argv[++i]);
 		else if (param == "--anchor_sample_counts_threshold") {
 			std::string tmp = argv[++i];
 			res.anchor_sample_counts_threshold = std::stoull(tmp);
@@ -128,30 +345,41 @@ Params read_params(int argc, char** argv)
 		}
 		else if (param == "--artifacts")
 			res.artifacts = argv[++i];
+		else if (param == "--anchor_list")
+			res.anchor_list = argv[++i];
 		else if (param == "--dont_filter_illumina_adapters")
 			res.dont_filter_illumina_adapters = true;
 	}
-	if (i >= argc) {
-		std::cerr << "Error: outbase missing\n";
-		exit(1);
-	}
+	if (!res.batch.empty())
+		res.batch_samples = read_batch(res.batch);
+	else {
+		if (i >= argc) {
+			std::cerr << "Error: outbase missing\n";
+			exit(1);
+		}
 
-	res.out_base = argv[i++];
-	if (i >= argc) {
-		std::cerr << "Error: input sample must be specified\n";
-		exit(1);
-	}
-	res.input_sample.input_kmc_db_path = argv[i++];
-	if (i >= argc) {
-		std::cerr << "Error: sample id missing\n";
-		exit(1);
+		res.out_base = argv[i++];
+		if (i >= argc) {
+			std::cerr << "Error: input sample must be specified\n";
+			exit(1);
+		}
+		res.input_sample.input_kmc_db_path = argv[i++];
+		if (i >= argc) {
+			std::cerr << "Error: sample id missing\n";
+			exit(1);
+		}
+		res.input_sample.sample_id = atoi(argv[i++]);
+		res.input_sample.out_base = res.out_base;
 	}
-	res.input_sample.sample_id = atoi(argv[i++]);
 
 	if (res.n_bins == 0) {
 		std::cerr << "Warning: number of bins was not specified, using default (64)\n";
 		res.n_bins = 64;
 	}
+	if (res.n_threads == 0)
+		res.n_threads = 1;
+	if (res.n_parallel_samples == 0)
+		res.n_parallel_samples = 1;
 	if (res.anchor_len == 0) {
 		std::cerr << "Error: anchor len (--anchor_len) must be specified\n";
 		exit(1);
@@ -160,6 +388,14 @@ Params read_params(int argc, char** argv)
 		std::cerr << "Error: target len (--target_len) must be specified\n";
 		exit(1);
 	}
+	if (res.build_sketch && !res.cohort_sketch.empty()) {
+		std::cerr << "Error: --build_sketch and --cohort_sketch cannot be used together\n";
+		exit(1);
+	}
+	if (res.sketch_depth == 0 || res.sketch_width_log2 == 0 || res.sketch_width_log2 > 32) {
+		std::cerr << "Error: wrong sketch size\n";
+		exit(1);
+	}
 	return res;
 }
 
@@ -185,15 +421,34 @@ void split(CKmerAPI& to_split, uint64_t& anchor, uint64_t& target, uint8_t ancho
 	target = to_split.subkmer(to_split.get_len() - target_len_symbols, target_len_symbols);
 }
 
+//single record of the output, used when records are buffered in memory before storing them in bins
+struct AnchorTargetCount {
+	uint64_t anchor;
+	uint64_t target;
+	uint64_t count;
+};
+
+inline void store_rec(buffered_binary_writer& bin, Record& rec, const Header& header) {
+	rec.serialize(bin, header);
+}
+
+inline void store_rec(std::vector<AnchorTargetCount>& bin, Record& rec, const Header& /*header*/) {
+	bin.push_back({ rec.anchor, rec.target, rec.count });
+}
+
+//BINS is std::vector<buffered_binary_writer> or std::vector<std::vector<AnchorTargetCount>>
+template<typename BINS>
 void sort_merge_and_store(uint64_t anchor,
 						  std::vector<TargetCount>& targets_in_current_anchor,
 						  const Header& header,
 						  Record& rec,
-						  std::vector<buffered_binary_writer>& bins,
+						  BINS& bins,
 						  uint64_t anchor_sample_counts_threshold,
 						  const PolyACGTFilter& poly_ACGT_filter,
 						  const ArtifactsFilter& artifacts_filter,
 						  const HammingFilter& hamming_filter,
+						  const AcceptedAnchors& accepted_anchors,
+						  const CohortPrescreen& cohort_prescreen,
 						  Stats& stats) {
 	rec.anchor = anchor;
 	if (targets_in_current_anchor.empty())
@@ -204,6 +459,11 @@ void sort_merge_and_store(uint64_t anchor,
 
 	++stats.tot_unique_anchors;
 
+	if (!accepted_anchors.IsAccepted(anchor)) {
+		++stats.tot_anchor_list_filtered_out;
+		return;
+	}
+
 	uint64_t tot_count{};
 	for (auto& x : targets_in_current_anchor)
 		tot_count += x.count;
@@ -228,11 +488,32 @@ void sort_merge_and_store(uint64_t anchor,
 		return;
 	}
 
+	std::sort(targets_in_current_anchor.begin(), targets_in_current_anchor.end(), [](const auto& e1, const auto& e2) {return e1.target < e2.target; }); //mkokot_TODO: use parallel sort? raduls?
+
+	if (cohort_prescreen.sketch_out || cohort_prescreen.sketch_in) {
+		uint64_t n_unique_targets = 1;
+		for (size_t i = 1; i < targets_in_current_anchor.size(); ++i)
+			if (targets_in_current_anchor[i].target != targets_in_current_anchor[i - 1].target)
+				++n_unique_targets;
+
+		if (cohort_prescreen.sketch_out) {
+			cohort_prescreen.sketch_out->Add(anchor, tot_count, n_unique_targets);
+			return;
+		}
+
+		if (cohort_prescreen.sketch_in->FilteredOut(anchor,
+			cohort_prescreen.anchor_count_threshold,
+			cohort_prescreen.anchor_unique_targets_threshold,
+			cohort_prescreen.anchor_samples_threshold)) {
+			++stats.tot_cohort_filtered_out;
+			return;
+		}
+	}
+
 	uint64_t n_bins = bins.size();
 	uint64_t bin_id = MurMur64Hash{}(anchor) % n_bins;
 	auto& bin = bins[bin_id];
 
-	std::sort(targets_in_current_anchor.begin(), targets_in_current_anchor.end(), [](const auto& e1, const auto& e2) {return e1.target < e2.target; }); //mkokot_TODO: use parallel sort? raduls?
 	rec.target = targets_in_current_anchor[0].target;
 	rec.count = targets_in_current_anchor[0].count;
 
@@ -240,7 +521,7 @@ void sort_merge_and_store(uint64_t anchor,
 		if (rec.target == targets_in_current_anchor[i].target)
 			rec.count += targets_in_current_anchor[i].count;
 		else {
-			rec.serialize(bin, header);
+			store_rec(bin, rec, header);
 			++stats.tot_out_recs;
 
 			rec.count = targets_in_current_anchor[i].count;
@@ -248,52 +529,117 @@ void sort_merge_and_store(uint64_t anchor,
 		}
 	}
 
-	rec.serialize(bin, header);
+	store_rec(bin, rec, header);
 
 	++stats.tot_out_recs;
 }
 
-void process_kmc_db(const std::string& path,
-					uint64_t sample_id,
-					const Header& header,
-					std::vector<buffered_binary_writer>& bins,
-					uint64_t anchor_sample_counts_threshold,
-					const PolyACGTFilter& poly_ACGT_filter,
-					const ArtifactsFilter& artifacts_filter,
-					const HammingFilter& hamming_filter,
-					Stats& stats)
-{
-	CKMCFile kmc_db;
-	if (!kmc_db.OpenForListing(path)) {
-		std::cerr << "Error: cannot open kmc db: " << path << "\n";
-		exit(1);
-	}
+//reads (anchor, target, count) from kmc db
+//for k <= 64 k-mers are decoded in batches directly into packed words, longer k-mers are read one by one with CKmerAPI
+class KmcAnchorTargetReader {
+	CKMCFile& kmc_db;
+	uint32_t kmer_len;
+	uint32_t anchor_len;
+	uint32_t target_len;
+	uint64_t anchor_mask;
+	uint64_t target_mask;
 
-	auto kmer_len = kmc_db.KmerLength();
-	if (kmc_db.IsKMC2()) {
-		std::cerr << "Error: kmc_db must be sorted (use kmc_tools transform <input_db> sort <output_db>\n";
-		exit(1);
+	bool bulk;
+	uint32_t n_words;
+	std::vector<uint64> kmers;
+	std::vector<uint64> counts;
+	uint64_t pos{};
+	uint64_t size{};
+
+	CKmerAPI kmer;
+
+	static const uint64_t batch_size = 1ull << 16;
+
+public:
+	KmcAnchorTargetReader(CKMCFile& kmc_db, uint32_t anchor_len, uint32_t target_len) :
+		kmc_db(kmc_db),
+		kmer_len(kmc_db.KmerLength()),
+		anchor_len(anchor_len),
+		target_len(target_len),
+		anchor_mask(((1ull << anchor_len) << anchor_len) - 1), //I shift twice because len may be 32...
+		target_mask(((1ull << target_len) << target_len) - 1),
+		bulk(kmer_len <= 64),
+		n_words(kmc_db.KmerWords()),
+		kmer(kmer_len) {
+		if (bulk) {
+			kmers.resize(batch_size * n_words);
+			counts.resize(batch_size);
+		}
 	}
 
-	CKmerAPI kmer(kmer_len);
-	uint32_t count;
+	bool Next(uint64_t& anchor, uint64_t& target, uint64_t& count) {
+		if (!bulk) {
+			uint32_t cnt;
+			if (!kmc_db.ReadNextKmer(kmer, cnt))
+				return false;
+			count = cnt;
+			split(kmer, anchor, target, anchor_len, target_len);
+			return true;
+		}
 
-	uint64_t tot_kmers = kmc_db.KmerCount();
+		if (pos == size) {
+			size = kmc_db.ReadNextKmersBulk(kmers.data(), counts.data(), batch_size);
+			pos = 0;
+			if (size == 0)
+				return false;
+		}
 
-	if (!kmc_db.ReadNextKmer(kmer, count)) {
-		std::cerr << "Warning: no k-mers in " << path << "\n";
-		return;
+		uint32_t anchor_shift = 2 * (kmer_len - anchor_len);
+		if (n_words == 1) {
+			uint64_t x = kmers[pos];
+			anchor = x >> anchor_shift;
+			target = x & target_mask;
+		}
+		else {
+			uint64_t hi = kmers[2 * pos];
+			uint64_t lo = kmers[2 * pos + 1];
+			if (anchor_shift >= 64)
+				anchor = hi >> (anchor_shift - 64);
+			else
+				anchor = ((lo >> anchor_shift) | (hi << (64 - anchor_shift))) & anchor_mask;
+			target = lo & target_mask;
+		}
+		count = counts[pos++];
+		return true;
 	}
-	++stats.tot_in_recs;
+};
 
-	uint64_t processed_kmers = 1;
+//list all k-mers of already opened kmc db (or its prefix range)
+template<typename BINS>
+void list_kmc_db(CKMCFile& kmc_db,
+				 uint64_t sample_id,
+				 const Header& header,
+				 BINS& bins,
+				 uint64_t anchor_sample_counts_threshold,
+				 const PolyACGTFilter& poly_ACGT_filter,
+				 const ArtifactsFilter& artifacts_filter,
+				 const HammingFilter& hamming_filter,
+				 const AcceptedAnchors& accepted_anchors,
+				 const CohortPrescreen& cohort_prescreen,
+				 Stats& stats,
+				 bool show_progress)
+{
+	KmcAnchorTargetReader reader(kmc_db, header.anchor_len_symbols, header.target_len_symbols);
+	uint64_t count;
+
+	uint64_t tot_kmers = kmc_db.KmerCount();
 
 	uint64_t prev_anchor;
 
 	uint64_t target;
 	std::vector<TargetCount> targets_in_current_anchor;
 
-	split(kmer, prev_anchor, target, header.anchor_len_symbols, header.target_len_symbols);
+	if (!reader.Next(prev_anchor, target, count))
+		return;
+
+	++stats.tot_in_recs;
+
+	uint64_t processed_kmers = 1;
 
 	uint64_t anchor = prev_anchor;
 
@@ -301,9 +647,8 @@ void process_kmc_db(const std::string& path,
 	Record rec;
 	rec.barcode = 0;
 	rec.sample_id = sample_id;
-	while (kmc_db.ReadNextKmer(kmer, count)) {
+	while (reader.Next(anchor, target, count)) {
 		++stats.tot_in_recs;
-		split(kmer, anchor, target, header.anchor_len_symbols, header.target_len_symbols);
 		if (prev_anchor == anchor)
 			targets_in_current_anchor.emplace_back(target, count);
 		else {
@@ -316,6 +661,8 @@ void process_kmc_db(const std::string& path,
 				poly_ACGT_filter,
 				artifacts_filter,
 				hamming_filter,
+				accepted_anchors,
+				cohort_prescreen,
 				stats);
 
 			targets_in_current_anchor.clear();
@@ -324,10 +671,9 @@ void process_kmc_db(const std::string& path,
 		}
 
 		++processed_kmers;
-		if (processed_kmers % 100'000'000 == 0)
+		if (show_progress && processed_kmers % 100'000'000 == 0)
 			std::cerr << "\r" << processed_kmers << "/" << tot_kmers << "\n";
 	}
-	std::cerr << "\n";
 
 	sort_merge_and_store(prev_anchor,
 		targets_in_current_anchor,
@@ -338,11 +684,332 @@ void process_kmc_db(const std::string& path,
 		poly_ACGT_filter,
 		artifacts_filter,
 		hamming_filter,
+		accepted_anchors,
+		cohort_prescreen,
 		stats);
 	targets_in_current_anchor.clear();
 }
 
-uint8_t verify_kmc_dbs_and_get_gap_len(SampleDesc& input_sample, uint64_t anchor_len, uint64_t target_len) {
+//split LUT into ranges of similar number of k-mers
+//all k-mers of a single anchor must be in a single range, so if LUT prefix is longer than anchor range boundaries are aligned
+std::vector<std::pair<uint64_t, uint64_t>> get_prefix_ranges(const std::vector<uint64>& lut, uint32_t lut_prefix_len, uint32_t anchor_len, uint64_t n_ranges) {
+	uint64_t lut_size = lut.size() - 1;
+	uint64_t align = lut_prefix_len > anchor_len ? 1ull << (2 * (lut_prefix_len - anchor_len)) : 1;
+	uint64_t tot_kmers = lut.back();
+	uint64_t kmers_per_range = (tot_kmers + n_ranges - 1) / n_ranges;
+
+	std::vector<std::pair<uint64_t, uint64_t>> res;
+	uint64_t range_start = 0;
+	for (uint64_t prefix = align; prefix < lut_size; prefix += align) {
+		if (lut[prefix] - lut[range_start] >= kmers_per_range) {
+			res.emplace_back(range_start, prefix);
+			range_start = prefix;
+		}
+	}
+	res.emplace_back(range_start, lut_size);
+	return res;
+}
+
+//with anchor list only LUT prefixes that may contain accepted anchors are listed
+//each range from get_prefix_ranges is replaced by a list of subranges, subranges separated by less than min_gap_kmers are joined
+//to not reopen kmc db too often
+std::vector<std::vector<std::pair<uint64_t, uint64_t>>> restrict_ranges_to_anchors(const std::vector<std::pair<uint64_t, uint64_t>>& ranges,
+	const std::vector<uint64>& lut, uint32_t lut_prefix_len, uint32_t anchor_len, const AcceptedAnchors& accepted_anchors) {
+	const uint64_t min_gap_kmers = 1ull << 16;
+
+	std::vector<std::vector<std::pair<uint64_t, uint64_t>>> res;
+	if (accepted_anchors.AcceptsAll()) {
+		for (const auto& range : ranges)
+			res.push_back({ range });
+		return res;
+	}
+
+	//prefix blocks are sorted because anchors are sorted
+	std::vector<std::pair<uint64_t, uint64_t>> blocks;
+	for (auto anchor : accepted_anchors.GetAnchors()) {
+		uint64_t begin, end;
+		if (anchor_len >= lut_prefix_len) {
+			begin = anchor >> (2 * (anchor_len - lut_prefix_len));
+			end = begin + 1;
+		}
+		else {
+			begin = anchor << (2 * (lut_prefix_len - anchor_len));
+			end = (anchor + 1) << (2 * (lut_prefix_len - anchor_len));
+		}
+		if (lut[begin] == lut[end])
+			continue;
+		if (!blocks.empty() && (begin <= blocks.back().second || lut[begin] - lut[blocks.back().second] < min_gap_kmers))
+			blocks.back().second = std::max(blocks.back().second, end);
+		else
+			blocks.emplace_back(begin, end);
+	}
+
+	//ranges are aligned to anchors, so a block may be split between ranges only if it was joined from many blocks
+	size_t block_id = 0;
+	for (const auto& range : ranges) {
+		std::vector<std::pair<uint64_t, uint64_t>> part;
+		for (; block_id < blocks.size() && blocks[block_id].first < range.second; ++block_id) {
+			auto begin = std::max(blocks[block_id].first, range.first);
+			auto end = std::min(blocks[block_id].second, range.second);
+			part.emplace_back(begin, end);
+			if (blocks[block_id].second > range.second)
+				break;
+		}
+		if (!part.empty())
+			res.push_back(std::move(part));
+	}
+	return res;
+}
+
+struct PartResult {
+	std::vector<std::vector<AnchorTargetCount>> bins;
+	Stats stats;
+	bool ready = false;
+};
+
+template<typename BINS>
+void process_kmc_db_parallel(const std::string& path,
+							 uint64_t sample_id,
+							 const Header& header,
+							 BINS& bins,
+							 uint64_t anchor_sample_counts_threshold,
+							 const PolyACGTFilter& poly_ACGT_filter,
+							 const ArtifactsFilter& artifacts_filter,
+							 const HammingFilter& hamming_filter,
+							 const AcceptedAnchors& accepted_anchors,
+							 const CohortPrescreen& cohort_prescreen,
+							 Stats& stats,
+							 uint32_t n_threads,
+							 CKMCFile& kmc_db)
+{
+	CKMCFileInfo info;
+	kmc_db.Info(info);
+	std::vector<uint64> lut;
+	if (!kmc_db.ReadLUT(lut)) {
+		std::cerr << "Error: cannot read LUT of kmc db: " << path << "\n";
+		exit(1);
+	}
+	kmc_db.Close();
+
+	//more parts than threads for better load balancing
+	auto ranges = restrict_ranges_to_anchors(get_prefix_ranges(lut, info.lut_prefix_length, header.anchor_len_symbols, 16ull * n_threads),
+		lut, info.lut_prefix_length, header.anchor_len_symbols, accepted_anchors);
+
+	//results of the parts are stored in bins in order, so only limited number of parts may be in memory
+	const size_t max_parts_in_memory = 2ull * n_threads;
+	std::vector<PartResult> parts(ranges.size());
+	size_t next_part = 0;
+	size_t n_stored_parts = 0;
+	std::mutex mtx;
+	std::condition_variable cv;
+
+	auto worker = [&]() {
+		while (true) {
+			size_t part_id;
+			{
+				std::unique_lock<std::mutex> lck(mtx);
+				cv.wait(lck, [&] {return next_part == ranges.size() || next_part < n_stored_parts + max_parts_in_memory; });
+				if (next_part == ranges.size())
+					return;
+				part_id = next_part++;
+			}
+			PartResult& part = parts[part_id];
+			part.bins.resize(bins.size());
+
+			for (const auto& range : ranges[part_id]) {
+				CKMCFile range_db;
+				if (!range_db.OpenForListingRange(path, range.first, range.second)) {
+					std::cerr << "Error: cannot open kmc db: " << path << "\n";
+					exit(1);
+				}
+				list_kmc_db(range_db,
+					sample_id,
+					header,
+					part.bins,
+					anchor_sample_counts_threshold,
+					poly_ACGT_filter,
+					artifacts_filter,
+					hamming_filter,
+					accepted_anchors,
+					cohort_prescreen,
+					part.stats,
+					false);
+			}
+
+			{
+				std::lock_guard<std::mutex> lck(mtx);
+				part.ready = true;
+			}
+			cv.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < n_threads; ++i)
+		threads.emplace_back(worker);
+
+	//ranges are in k-mer order, so concatenation of parts keeps anchors sorted in each bin
+	Record rec;
+	rec.barcode = 0;
+	rec.sample_id = sample_id;
+	for (size_t part_id = 0; part_id < parts.size(); ++part_id) {
+		{
+			std::unique_lock<std::mutex> lck(mtx);
+			cv.wait(lck, [&] {return parts[part_id].ready; });
+		}
+		auto& part = parts[part_id];
+		for (size_t bin_id = 0; bin_id < bins.size(); ++bin_id)
+			for (const auto& x : part.bins[bin_id]) {
+				rec.anchor = x.anchor;
+				rec.target = x.target;
+				rec.count = x.count;
+				store_rec(bins[bin_id], rec, header);
+			}
+
+		stats.tot_poly_filtered_out += part.stats.tot_poly_filtered_out;
+		stats.tot_artifacts_filtered_out += part.stats.tot_artifacts_filtered_out;
+		stats.tot_hamming_distance_filtered_out += part.stats.tot_hamming_distance_filtered_out;
+		stats.tot_cnt_threshold_filtered_out += part.stats.tot_cnt_threshold_filtered_out;
+		stats.tot_cohort_filtered_out += part.stats.tot_cohort_filtered_out;
+		stats.tot_anchor_list_filtered_out += part.stats.tot_anchor_list_filtered_out;
+		stats.tot_unique_anchors += part.stats.tot_unique_anchors;
+		stats.tot_out_recs += part.stats.tot_out_recs;
+		stats.tot_in_recs += part.stats.tot_in_recs;
+
+		part.bins.clear();
+		part.bins.shrink_to_fit();
+		{
+			std::lock_guard<std::mutex> lck(mtx);
+			++n_stored_parts;
+		}
+		cv.notify_all();
+	}
+
+	for (auto& t : threads)
+		t.join();
+}
+
+template<typename BINS>
+void process_kmc_db(const std::string& path,
+					uint64_t sample_id,
+					const Header& header,
+					BINS& bins,
+					uint64_t anchor_sample_counts_threshold,
+					const PolyACGTFilter& poly_ACGT_filter,
+					const ArtifactsFilter& artifacts_filter,
+					const HammingFilter& hamming_filter,
+					const AcceptedAnchors& accepted_anchors,
+					const CohortPrescreen& cohort_prescreen,
+					Stats& stats,
+					uint32_t n_threads)
+{
+	CKMCFile kmc_db;
+	if (!kmc_db.OpenForListing(path)) {
+		std::cerr << "Error: cannot open kmc db: " << path << "\n";
+		exit(1);
+	}
+
+	if (kmc_db.IsKMC2()) {
+		std::cerr << "Error: kmc_db must be sorted (use kmc_tools transform <input_db> sort <output_db>\n";
+		exit(1);
+	}
+
+	if (kmc_db.KmerCount() == 0) {
+		std::cerr << "Warning: no k-mers in " << path << "\n";
+		return;
+	}
+
+	//with anchor list parallel mode is used also for a single thread, because only a part of the kmc db is listed
+	if (n_threads > 1 || !accepted_anchors.AcceptsAll()) {
+		process_kmc_db_parallel(path,
+			sample_id,
+			header,
+			bins,
+			anchor_sample_counts_threshold,
+			poly_ACGT_filter,
+			artifacts_filter,
+			hamming_filter,
+			accepted_anchors,
+			cohort_prescreen,
+			stats,
+			n_threads,
+			kmc_db);
+		return;
+	}
+
+	list_kmc_db(kmc_db,
+		sample_id,
+		header,
+		bins,
+		anchor_sample_counts_threshold,
+		poly_ACGT_filter,
+		artifacts_filter,
+		hamming_filter,
+		accepted_anchors,
+		cohort_prescreen,
+		stats,
+		true);
+	std::cerr << "\n";
+}
+
+template<typename BINS>
+void process_reads(const std::string& path,
+				   InputType input_format,
+				   uint64_t sample_id,
+				   const Header& header,
+				   BINS& bins,
+				   uint64_t anchor_sample_counts_threshold,
+				   const PolyACGTFilter& poly_ACGT_filter,
+				   const ArtifactsFilter& artifacts_filter,
+				   const HammingFilter& hamming_filter,
+				   const AcceptedAnchors& accepted_anchors,
+				   const CohortPrescreen& cohort_prescreen,
+				   Stats& stats)
+{
+	//counter is stored in counter_size_bytes, same as kmc run with -cs65535
+	uint64_t max_count = (1ull << (8 * header.counter_size_bytes)) - 1;
+	ReadsCounter reads_counter(header.anchor_len_symbols, header.gap_len_symbols, header.target_len_symbols, bins.size(), max_count,
+		accepted_anchors.AcceptsAll() ? nullptr : &accepted_anchors);
+
+	if (!reads_counter.ProcessFile(path, input_format == InputType::fastq ? input_format_t::fastq : input_format_t::fasta)) {
+		std::cerr << "Error: cannot open file: " << path << "\n";
+		exit(1);
+	}
+	std::cerr << "# reads: " << reads_counter.GetNReads() << ", # anchor-target pairs: " << reads_counter.GetNPairs() << "\n";
+
+	Record rec;
+	rec.barcode = 0;
+	rec.sample_id = sample_id;
+
+	std::vector<ReadsCounter::AnchorTargetCount> bin_content;
+	std::vector<TargetCount> targets_in_current_anchor;
+	for (uint64_t bin_id = 0; bin_id < bins.size(); ++bin_id) {
+		reads_counter.GetBin(bin_id, bin_content);
+		stats.tot_in_recs += bin_content.size();
+
+		for (size_t i = 0; i < bin_content.size(); ) {
+			auto anchor = bin_content[i].anchor;
+			targets_in_current_anchor.clear();
+			for (; i < bin_content.size() && bin_content[i].anchor == anchor; ++i)
+				targets_in_current_anchor.emplace_back(bin_content[i].target, bin_content[i].count);
+
+			sort_merge_and_store(anchor,
+				targets_in_current_anchor,
+				header,
+				rec,
+				bins,
+				anchor_sample_counts_threshold,
+				poly_ACGT_filter,
+				artifacts_filter,
+				hamming_filter,
+				accepted_anchors,
+				cohort_prescreen,
+				stats);
+		}
+	}
+}
+
+uint8_t verify_kmc_dbs_and_get_gap_len(const SampleDesc& input_sample, uint64_t anchor_len, uint64_t target_len) {
 
 	CKMCFile kmc_file;
 	if (!kmc_file.OpenForListing(input_sample.input_kmc_db_path)) {
@@ -371,17 +1038,26 @@ constexpr uint32_t no_bytes(uint32_t x)
 	return 4;
 }
 
-int main(int argc, char** argv)
+//out_files (and container, used only with bins container) are reused between samples processed by the same thread
+void process_sample(const Params& params,
+					const SampleDesc& sample,
+					std::vector<buffered_binary_writer>& out_files,
+					BinContainerWriter& container,
+					async_task_pool* compression_pool,
+					const TempCodec& temp_codec,
+					const PolyACGTFilter& poly_ACGT_filter,
+					const ArtifactsFilter& artifacts_filter,
+					const HammingFilter& hamming_filter,
+					const AcceptedAnchors& accepted_anchors,
+					const CohortPrescreen& cohort_prescreen,
+					Stats& stats)
 {
-	std::cerr << "Welcome to satc (sample anchor target count)\n";
-
-	auto params = read_params(argc, argv);
-
-	params.Print(std::cerr);
-
 	Header header;
 
-	header.sample_id_size_bytes = no_bytes(params.input_sample.sample_id);
+	header.encoding = params.rec_encoding;
+	header.indexed = params.indexed;
+	header.with_stats = params.bin_stats;
+	header.sample_id_size_bytes = no_bytes(sample.sample_id);
 	header.barcode_size_bytes = 0;
 	header.counter_size_bytes = 2;
 	header.barcode_len_symbols = 0;
@@ -390,39 +1066,270 @@ int main(int argc, char** argv)
 	header.anchor_size_bytes = (header.anchor_len_symbols + 3) / 4;
 	header.target_size_bytes = (header.target_len_symbols + 3) / 4;
 
-	header.gap_len_symbols = verify_kmc_dbs_and_get_gap_len(params.input_sample, params.anchor_len, params.target_len);
+	if (params.input_format == InputType::kmc)
+		header.gap_len_symbols = verify_kmc_dbs_and_get_gap_len(sample, params.anchor_len, params.target_len);
+	else
+		header.gap_len_symbols = params.gap_len;
 
-	header.print(std::cerr);
+	if (params.batch.empty())
+		header.print(std::cerr);
 
-	std::vector<buffered_binary_writer> out_files;
-	for (size_t i = 0; i < params.n_bins; ++i) {
-		auto fname = params.out_base + "." + std::to_string(i) + ".bin";
-		out_files.emplace_back(fname);
-		auto& outfile = out_files.back();
-		if (!outfile) {
+	auto process = [&](auto& bins, const CohortPrescreen& prescreen) {
+		if (params.input_format == InputType::kmc)
+			process_kmc_db(sample.input_kmc_db_path,
+				sample.sample_id,
+				header,
+				bins,
+				params.anchor_sample_counts_threshold,
+				poly_ACGT_filter,
+				artifacts_filter,
+				hamming_filter,
+				accepted_anchors,
+				prescreen,
+				stats,
+				params.n_threads);
+		else
+			process_reads(sample.input_kmc_db_path,
+				params.input_format,
+				sample.sample_id,
+				header,
+				bins,
+				params.anchor_sample_counts_threshold,
+				poly_ACGT_filter,
+				artifacts_filter,
+				hamming_filter,
+				accepted_anchors,
+				prescreen,
+				stats);
+	};
+
+	//first pass of the cohort pre-screen, nothing is stored to bins
+	if (params.build_sketch) {
+		AnchorSketch sketch(params.sketch_depth, params.sketch_width_log2);
+		CohortPrescreen prescreen = cohort_prescreen;
+		prescreen.sketch_out = &sketch;
+		std::vector<std::vector<AnchorTargetCount>> bins(params.n_bins);
+		process(bins, prescreen);
+
+		auto fname = sample.out_base + ".sketch";
+		if (!sketch.Save(fname)) {
 			std::cerr << "Error: cannot open file " << fname << "\n";
+			exit(1);
 		}
-		header.serialize(outfile);
+		return;
 	}
 
-	Stats stats;
+	bool reuse = !out_files.empty();
+	if (params.bins_container)
+		container.open(bin_container_path(sample.out_base), params.n_bins);
+	for (size_t i = 0; i < params.n_bins; ++i) {
+		if (params.bins_container) {
+			if (reuse)
+				out_files[i].reopen(container, i);
+			else
+				out_files.emplace_back(container, i, 1ull << 25, compression_pool, temp_codec);
+			header.serialize(out_files[i]);
+			continue;
+		}
+		auto fname = sample.out_base + "." + std::to_string(i) + ".bin";
+		if (reuse) {
+			if (!out_files[i].reopen(fname))
+				std::cerr << "Error: cannot open file " << fname << "\n";
+		}
+		else {
+			out_files.emplace_back(fname, 1ull << 25, compression_pool, temp_codec);
+			if (!out_files.back())
+				std::cerr << "Error: cannot open file " << fname << "\n";
+		}
+		header.serialize(out_files[i]);
+	}
+
+	process(out_files, cohort_prescreen);
+
+	//writers are closed so bins are complete, they are reopened for the next sample
+	if (params.bins_container) {
+		for (size_t i = 0; i < params.n_bins; ++i)
+			out_files[i].close();
+		if (!container.close()) {
+			std::cerr << "Error: cannot write file " << bin_container_path(sample.out_base) << "\n";
+			exit(1);
+		}
+	}
+}
+
+//filters are built once and shared by all samples, each thread has its own set of n_bins writers
+void process_batch(const Params& params,
+				   async_task_pool* compression_pool,
+				   const TempCodec& temp_codec,
+				   const PolyACGTFilter& poly_ACGT_filter,
+				   const ArtifactsFilter& artifacts_filter,
+				   const HammingFilter& hamming_filter,
+				   const AcceptedAnchors& accepted_anchors,
+				   const CohortPrescreen& cohort_prescreen)
+{
+	std::atomic<size_t> next_sample{};
+	std::mutex print_mtx;
+
+	auto worker = [&]() {
+		BinContainerWriter container;
+		std::vector<buffered_binary_writer> out_files;
+		while (true) {
+			size_t sample_no = next_sample++;
+			if (sample_no >= params.batch_samples.size())
+				break;
+			const auto& sample = params.batch_samples[sample_no];
+			Stats stats;
+			process_sample(params, sample, out_files, container, compression_pool, temp_codec, poly_ACGT_filter, artifacts_filter, hamming_filter, accepted_anchors, cohort_prescreen, stats);
+
+			std::lock_guard<std::mutex> lck(print_mtx);
+			std::cerr << "sample " << sample.sample_id << " (" << sample.input_kmc_db_path << ") done\n";
+			stats.print(std::cerr);
+		}
+		for (auto& out : out_files)
+			out.close();
+	};
+
+	uint32_t n_threads = std::min<size_t>(params.n_parallel_samples, params.batch_samples.size());
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < n_threads; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& t : threads)
+		t.join();
+}
+
+//merged sketch is the sum of per sample sketches
+void merge_sketches(const std::string& out_path, const std::string& list_path)
+{
+	std::ifstream in(list_path);
+	if (!in) {
+		std::cerr << "Error: cannot open file " << list_path << "\n";
+		exit(1);
+	}
+
+	AnchorSketch merged;
+	std::string path;
+	while (in >> path) {
+		AnchorSketch sketch;
+		if (!sketch.Load(path)) {
+			std::cerr << "Error: cannot load sketch " << path << "\n";
+			exit(1);
+		}
+		merged.Merge(sketch);
+	}
+	if (merged.empty()) {
+		std::cerr << "Error: no sketches in " << list_path << "\n";
+		exit(1);
+	}
+	if (!merged.Save(out_path)) {
+		std::cerr << "Error: cannot open file " << out_path << "\n";
+		exit(1);
+	}
+}
+
+//dictionary for the rest of samples of the run is trained on bins of the first samples
+void train_temp_dict(const std::string& out_path, const std::string& list_path)
+{
+	std::ifstream in(list_path);
+	if (!in) {
+		std::cerr << "Error: cannot open file " << list_path << "\n";
+		exit(1);
+	}
+	std::vector<std::string> paths;
+	std::string path;
+	while (in >> path)
+		paths.push_back(path);
+	if (paths.empty()) {
+		std::cerr << "Error: no bins in " << list_path << "\n";
+		exit(1);
+	}
+
+	//zstd works best with many small samples, at most 64MB in total
+	const size_t chunk_size = 1ull << 14;
+	const size_t max_per_bin = std::min<size_t>(1ull << 20, (1ull << 26) / paths.size());
+
+	std::vector<uint8_t> samples;
+	std::vector<size_t> sample_sizes;
+	for (const auto& path : paths) {
+		buffered_binary_reader bin(path);
+		if (!bin) {
+			std::cerr << "Error: cannot open file " << path << "\n";
+			exit(1);
+		}
+		Header header;
+		header.load(bin);
+		for (size_t done = 0; done < max_per_bin; ) {
+			auto old_size = samples.size();
+			samples.resize(old_size + std::min(chunk_size, max_per_bin - done));
+			auto readed = bin.read_raw(samples.data() + old_size, samples.size() - old_size);
+			samples.resize(old_size + readed);
+			if (!readed)
+				break;
+			sample_sizes.push_back(readed);
+			done += readed;
+		}
+	}
+
+	if (TempCodec::TrainDictionary(samples, sample_sizes, out_path))
+		std::cerr << "dictionary stored in " << out_path << "\n";
+}
+
+int main(int argc, char** argv)
+{
+	std::cerr << "Welcome to satc (sample anchor target count)\n";
+
+	if (argc == 4 && std::string(argv[1]) == "--merge_sketches") {
+		merge_sketches(argv[2], argv[3]);
+		return 0;
+	}
+
+	if (argc == 4 && std::string(argv[1]) == "--train_temp_dict") {
+		train_temp_dict(argv[2], argv[3]);
+		return 0;
+	}
+
+	auto params = read_params(argc, argv);
+
+	params.Print(std::cerr);
 
 	PolyACGTFilter poly_ACGT_filter(params.poly_ACGT_len);
 	ArtifactsFilter artifacts_filter(params.artifacts);
 	HammingFilter hamming_filter(params.min_hamming_threshold);
+	AcceptedAnchors accepted_anchors(params.anchor_list);
 
 	if (!params.dont_filter_illumina_adapters)
 		artifacts_filter.Add(12, IlluminaAdaptersStatic::Get12Mers());
 
-	process_kmc_db(params.input_sample.input_kmc_db_path,
-		params.input_sample.sample_id,
-		header,
-		out_files,
-		params.anchor_sample_counts_threshold,
-		poly_ACGT_filter,
-		artifacts_filter,
-		hamming_filter,
-		stats);
+	TempCodec temp_codec(params.temp_codec, params.temp_codec_level, params.temp_dict);
+
+	std::unique_ptr<async_task_pool> compression_pool;
+	if (params.n_compression_threads)
+		compression_pool = std::make_unique<async_task_pool>(params.n_compression_threads);
+
+	AnchorSketch cohort_sketch;
+	CohortPrescreen cohort_prescreen;
+	if (!params.cohort_sketch.empty()) {
+		if (!cohort_sketch.Load(params.cohort_sketch)) {
+			std::cerr << "Error: cannot load sketch " << params.cohort_sketch << "\n";
+			exit(1);
+		}
+		cohort_prescreen.sketch_in = &cohort_sketch;
+		cohort_prescreen.anchor_count_threshold = params.cohort_anchor_count_threshold;
+		cohort_prescreen.anchor_unique_targets_threshold = params.cohort_anchor_unique_targets_threshold;
+		cohort_prescreen.anchor_samples_threshold = params.cohort_anchor_samples_threshold;
+	}
+
+	if (!params.batch.empty()) {
+		process_batch(params, compression_pool.get(), temp_codec, poly_ACGT_filter, artifacts_filter, hamming_filter, accepted_anchors, cohort_prescreen);
+		return 0;
+	}
+
+	BinContainerWriter container;
+	std::vector<buffered_binary_writer> out_files;
+	Stats stats;
+
+	process_sample(params, params.input_sample, out_files, container, compression_pool.get(), temp_codec, poly_ACGT_filter, artifacts_filter, hamming_filter, accepted_anchors, cohort_prescreen, stats);
+	out_files.clear();
 
 	stats.print(std::cerr);
 }
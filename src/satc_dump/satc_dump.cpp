@@ -7,14 +7,22 @@
 #include <vector>
 #include <cstdint>
 #include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
 
 struct Params {
 	std::string input;
 	std::string output;
 	std::string anchor_list_path;
 	std::string sample_names;
+	std::string temp_dict;
 	uint32_t n_bins = 0;
 	bool separately = false;
+	bool stats_only = false;
+	uint32_t n_threads = 1;
 
 	RecFmt format = RecFmt::SATC;
 	void Print(std::ostream& oss) const
@@ -23,8 +31,11 @@ struct Params {
 		oss << "output        : " << output << "\n";
 		oss << "anchor_list   : " << anchor_list_path << "\n";
 		oss << "sample_names  : " << sample_names << "\n";
+		oss << "temp_dict     : " << temp_dict << "\n";
 		oss << "n_bins        : " << n_bins << "\n";
 		oss << "separately    : " << std::boolalpha << separately << "\n";
+		oss << "stats_only    : " << std::boolalpha << stats_only << "\n";
+		oss << "n_threads     : " << n_threads << "\n";
 		oss << "format        : " << RecFmtConv::to_string(format) << "\n";
 	}
 
@@ -36,15 +47,18 @@ struct Params {
 		std::cerr << "\t" << prog_name << " --which-bin --n_bins <int> <anchor>\n";
 		std::cerr
 			<< "Positional parameters:\n"
-			<< "    <input> - path to binary file in satc format\n"
+			<< "    <input> - path to binary file in satc format (or <container>.bins:<bin_id> for a bin stored by satc --bins_container)\n"
 			<< "    <output> - output path\n";
 		std::cerr
 			<< "Options:\n"
 			<< "    --anchor_list <path>  - path to text file containing anchors separated by whitespaces, only anchors from this file will be dumped\n"
 			<< "    --sample_names <path> - path for decode sample id, each line should contain <sample_name> <sample_id>\n"
 			<< "    --format <string>     - output format, available options: satc, splash (default: satc)\n"
+			<< "    --temp_dict <path>    - zstd dictionary the input was compressed with (satc --temp_codec zstd_dict)\n"
 			<< "    --n_bins <int>        - if set to value different than 0 the input is interpreted as a list of bins (each bin in separate line, first list is bin_0, second line is bin_1, etc. (in case of ill-formed input results will be incorrect)\n"
-			<< "    --separately          - if set with n_bins != 0 output param will be treated as suffix name and there will be output for each bin\n";
+			<< "    --separately          - if set with n_bins != 0 output param will be treated as suffix name and there will be output for each bin\n"
+			<< "    --n_threads <int>     - number of bins (with n_bins != 0) dumped in parallel, without --separately bins are dumped to temporary files <output>.bin{bin_id}.part concatenated in order (default: 1)\n"
+			<< "    --stats_only          - if set only the number of records of each bin (from stats footer, satc --bin_stats, 0 if there is no footer) is written to output, a line per bin\n";
 	}
 };
 
@@ -107,12 +121,18 @@ Params read_params(int argc, char** argv)
 			res.anchor_list_path = argv[++i];
 		else if (param == "--sample_names")
 			res.sample_names = argv[++i];
+		else if (param == "--temp_dict")
+			res.temp_dict = argv[++i];
 		else if (param == "--format")
 			res.format = RecFmtConv::from_string(argv[++i]);
 		else if (param == "--separately")
 			res.separately = true;
+		else if (param == "--stats_only")
+			res.stats_only = true;
 		else if (param == "--n_bins")
 			res.n_bins = std::atol(argv[++i]);
+		else if (param == "--n_threads")
+			res.n_threads = std::max(1l, std::atol(argv[++i]));
 	}
 	if (i >= argc) {
 		std::cerr << "Error: input missing\n";
@@ -129,8 +149,34 @@ Params read_params(int argc, char** argv)
 	return res;
 }
 
+//in indexed files with sorted anchors only blocks that may contain accepted anchors are read
+template<typename PRINT>
+void dump_accepted(buffered_binary_reader& in, const Header& header, const AcceptedAnchors& accepted_anchors, const PRINT& print) {
+	Record rec;
+	RecordBatch batch;
+	bool seekable = in.is_seekable();
+	while (batch.load(in, header, 1ull << 12)) {
+		for (size_t i = 0; i < batch.size(); ++i) {
+			if (accepted_anchors.IsAccepted(batch.anchors[i])) {
+				batch.get(i, rec);
+				print(rec);
+				continue;
+			}
+			if (!seekable)
+				continue;
+			uint64_t next_accepted;
+			if (!accepted_anchors.GetNextAccepted(batch.anchors[i], next_accepted))
+				return;
+			//the rest of the batch is before the block jumped to
+			if (in.seek_to_anchor(next_accepted))
+				break;
+		}
+	}
+}
+
 void process_single_bin_mode(const Params& params) {
-	buffered_binary_reader in(params.input);
+	TempCodec temp_codec(TempCodecType::zstd, 9, params.temp_dict);
+	buffered_binary_reader in(params.input, 1ull << 16, temp_codec);
 	if (!in) {
 		std::cerr << "Error: cannot open file " << params.input << "\n";
 		exit(1);
@@ -145,14 +191,15 @@ void process_single_bin_mode(const Params& params) {
 	Header header;
 	header.load(in);
 	header.print(std::cerr);
+	if (in.has_stats())
+		in.get_stats().Print(std::cerr);
 
 	AcceptedAnchors accepted_anchors(params.anchor_list_path);
-	Record rec;
 	SampleNameDecoder sample_name_decoder(params.sample_names);
-	while (rec.load(in, header)) {
-		if (accepted_anchors.IsAccepted(rec.anchor))
-			rec.print(out, header, params.format, sample_name_decoder);
-	}
+	TextWriter text_out(out);
+	dump_accepted(in, header, accepted_anchors, [&](Record& rec) {
+		rec.print(text_out, header, params.format, sample_name_decoder);
+	});
 }
 
 std::vector<std::string> read_bins_paths(const std::string& path, uint32_t n_bins) {
@@ -174,6 +221,29 @@ std::vector<std::string> read_bins_paths(const std::string& path, uint32_t n_bin
 	return bin_paths;
 }
 
+//records are not read, only headers and footers
+void process_stats_only_mode(const Params& params) {
+	auto bin_paths = params.n_bins ? read_bins_paths(params.input, params.n_bins) : std::vector<std::string>{ params.input };
+	TempCodec temp_codec(TempCodecType::zstd, 9, params.temp_dict);
+
+	std::ofstream out(params.output);
+	if (!out) {
+		std::cerr << "Error: cannot open file " << params.output << "\n";
+		exit(1);
+	}
+
+	for (const auto& path : bin_paths) {
+		buffered_binary_reader in(path, 1ull << 16, temp_codec);
+		if (!in) {
+			std::cerr << "Error: cannot open file " << path << "\n";
+			exit(1);
+		}
+		Header header;
+		header.load(in);
+		out << (in.has_stats() ? in.get_stats().n_recs : 0) << "\n";
+	}
+}
+
 std::vector<std::vector<uint64_t>> split_anchors(const std::string& path, uint32_t n_bins) {
 	std::vector<std::vector<uint64_t>> res;
 	if (path == "") {
@@ -196,14 +266,38 @@ std::vector<std::vector<uint64_t>> split_anchors(const std::string& path, uint32
 	return res;
 }
 
+//bins dumped in parallel are written to separate files, without --separately they are concatenated in order
 class SeparatelyOrNot {
 	std::string out_path;
 	bool separately;
+	bool parallel;
 	std::ofstream out;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::vector<bool> done;
+
+	std::string part_path(uint32_t bin_id) const {
+		return out_path + ".bin" + std::to_string(bin_id) + ".part";
+	}
+
+	void append_part(uint32_t bin_id) {
+		auto path = part_path(bin_id);
+		std::ifstream in(path, std::ios::binary);
+		if (!in) {
+			std::cerr << "Error: cannot open file " << path << "\n";
+			exit(1);
+		}
+		out << in.rdbuf();
+		in.close();
+		std::remove(path.c_str());
+	}
 public:
-	SeparatelyOrNot(const std::string& out_path, bool separately) :
+	SeparatelyOrNot(const std::string& out_path, bool separately, uint32_t n_bins, bool parallel) :
 		out_path(out_path),
-		separately(separately) {
+		separately(separately),
+		parallel(parallel),
+		done(n_bins) {
 		if (!separately) {
 			out.open(out_path);
 			if (!out) {
@@ -213,56 +307,106 @@ public:
 		}
 	}
 
-	void StartBin(uint32_t bin_id) {
-		if (separately) {
-			std::string fname = "bin" + std::to_string(bin_id) + "." + out_path;
-			out = std::ofstream(fname);
-			if (!out) {
-				std::cerr << "Error: cannot open file " << fname << "\n";
-				exit(1);
-			}
+	//output of a single bin
+	std::ofstream StartBin(uint32_t bin_id) {
+		if (!separately && !parallel)
+			return {};
+		std::string fname = separately ? "bin" + std::to_string(bin_id) + "." + out_path : part_path(bin_id);
+		std::ofstream res(fname);
+		if (!res) {
+			std::cerr << "Error: cannot open file " << fname << "\n";
+			exit(1);
 		}
+		return res;
+	}
+
+	std::ostream& get_out(std::ofstream& bin_out) {
+		return bin_out.is_open() ? bin_out : out;
 	}
-	std::ofstream& get_out() {
-		return out;
+
+	void EndBin(uint32_t bin_id, std::ofstream& bin_out) {
+		bin_out.close();
+		std::lock_guard<std::mutex> lck(mtx);
+		done[bin_id] = true;
+		cv.notify_all();
+	}
+
+	//called by the main thread, parts are appended as soon as they are complete
+	void ConcatenateParts() {
+		if (separately || !parallel)
+			return;
+		for (uint32_t bin_id = 0; bin_id < done.size(); ++bin_id) {
+			{
+				std::unique_lock<std::mutex> lck(mtx);
+				cv.wait(lck, [&] {return done[bin_id]; });
+			}
+			append_part(bin_id);
+		}
 	}
 };
 
 void process_multibin_mode(const Params& params) {
 	auto bin_paths = read_bins_paths(params.input, params.n_bins);
-	std::vector<std::vector<uint64_t>> anchors_bins(params.n_bins);
 	auto bins_anchors = split_anchors(params.anchor_list_path, params.n_bins);
 	bool accept_all = bins_anchors.empty();
 
-	SeparatelyOrNot separately_or_not(params.output, params.separately);
+	uint32_t n_threads = std::min(params.n_threads, params.n_bins);
+	SeparatelyOrNot separately_or_not(params.output, params.separately, params.n_bins, n_threads > 1);
 	SampleNameDecoder sample_name_decoder(params.sample_names);
-	for (uint32_t bin_id = 0; bin_id < params.n_bins; ++bin_id) {
-		separately_or_not.StartBin(bin_id);
+	TempCodec temp_codec(TempCodecType::zstd, 9, params.temp_dict);
+
+	std::mutex print_mtx;
+	auto dump_bin = [&](uint32_t bin_id) {
+		std::ofstream bin_out = separately_or_not.StartBin(bin_id);
 
 		if (!accept_all && bins_anchors[bin_id].empty()) {
+			std::lock_guard<std::mutex> lck(print_mtx);
 			std::cerr << "INFO: non of specified anchors occurs in bin " << bin_id << " (" << bin_paths[bin_id]<< "). Skip reading bin content.\n";
-			continue;
 		}
-		AcceptedAnchors accepted_anchors(accept_all ? std::vector<uint64_t>{} : bins_anchors[bin_id]);
+		else {
+			AcceptedAnchors accepted_anchors(accept_all ? std::vector<uint64_t>{} : bins_anchors[bin_id]);
 
-		buffered_binary_reader in(bin_paths[bin_id]);
-		if (!in) {
-			std::cerr << "Error: cannot open file " << bin_paths[bin_id] << "\n";
-			exit(1);
-		}
-
-		std::cerr << "Process bin " << bin_id << " (" << bin_paths[bin_id] << ")\n";
+			buffered_binary_reader in(bin_paths[bin_id], 1ull << 16, temp_codec);
+			if (!in) {
+				std::cerr << "Error: cannot open file " << bin_paths[bin_id] << "\n";
+				exit(1);
+			}
 
-		Header header;
-		header.load(in);
-		header.print(std::cerr);
+			Header header;
+			header.load(in);
+			{
+				std::lock_guard<std::mutex> lck(print_mtx);
+				std::cerr << "Process bin " << bin_id << " (" << bin_paths[bin_id] << ")\n";
+				header.print(std::cerr);
+				if (in.has_stats())
+					in.get_stats().Print(std::cerr);
+			}
 
-		Record rec;
-		while (rec.load(in, header)) {
-			if (accepted_anchors.IsAccepted(rec.anchor))
-				rec.print(separately_or_not.get_out(), header, params.format, sample_name_decoder);
+			TextWriter text_out(separately_or_not.get_out(bin_out));
+			dump_accepted(in, header, accepted_anchors, [&](Record& rec) {
+				rec.print(text_out, header, params.format, sample_name_decoder);
+			});
 		}
+		separately_or_not.EndBin(bin_id, bin_out);
+	};
+
+	if (n_threads <= 1) {
+		for (uint32_t bin_id = 0; bin_id < params.n_bins; ++bin_id)
+			dump_bin(bin_id);
+		return;
 	}
+
+	std::atomic<uint32_t> next_bin{};
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < n_threads; ++i)
+		threads.emplace_back([&] {
+			uint32_t bin_id;
+			while ((bin_id = next_bin++) < params.n_bins)
+				dump_bin(bin_id);
+		});
+	separately_or_not.ConcatenateParts();
+	for (auto& t : threads)
+		t.join();
 }
 
 int main(int argc, char** argv) {
@@ -272,7 +416,9 @@ int main(int argc, char** argv) {
 	auto params = read_params(argc, argv);
 	params.Print(std::cerr);
 
-	if (params.n_bins == 0)
+	if (params.stats_only)
+		process_stats_only_mode(params);
+	else if (params.n_bins == 0)
 		process_single_bin_mode(params);
 	else
 		process_multibin_mode(params);
@@ -25,8 +25,8 @@ Anchor merge_keep_target_order(const std::vector<Anchor>& to_merge, uint64_t& n_
 		//find min target
 		for (size_t i = 0; i < to_merge.size(); ++i) {
 			if (read_pos[i] < to_merge[i].data.size()) {
-				if (to_merge[i].data[read_pos[i]].target < min_target) {
-					min_target = to_merge[i].data[read_pos[i]].target;
+				if (to_merge[i].target(to_merge[i].data[read_pos[i]]) < min_target) {
+					min_target = to_merge[i].target(to_merge[i].data[read_pos[i]]);
 				}
 			}
 		}
@@ -36,9 +36,10 @@ Anchor merge_keep_target_order(const std::vector<Anchor>& to_merge, uint64_t& n_
 		//store all record having min target in the result
 		for (size_t i = 0; i < to_merge.size(); ++i) {
 			if (read_pos[i] < to_merge[i].data.size()) {
-				if (to_merge[i].data[read_pos[i]].target == min_target) {
-					res.data.push_back(to_merge[i].data[read_pos[i]]);
-					tot_cnt += res.data.back().count;
+				if (to_merge[i].target(to_merge[i].data[read_pos[i]]) == min_target) {
+					const auto& x = to_merge[i].data[read_pos[i]];
+					res.add(x.barcode, min_target, x.sample_id, x.count);
+					tot_cnt += x.count;
 
 					++read_pos[i];
 					--records_left;
@@ -46,6 +47,7 @@ Anchor merge_keep_target_order(const std::vector<Anchor>& to_merge, uint64_t& n_
 			}
 		}
 	}
+	res.targets.shrink_to_fit();
 	res.data.shrink_to_fit();
 	return res;
 }
@@ -76,7 +78,7 @@ Anchor merge_keep_target_order_binary_heap(const std::vector<Anchor>& to_merge,
 
 	for (size_t id = 0; id < to_merge.size(); ++id) {
 		if (to_merge[id].data.size())
-			heap.emplace_back(to_merge[id].data[0].target, id);
+			heap.emplace_back(to_merge[id].targets[0], id);
 	}
 
 	std::make_heap(heap.begin(), heap.end());
@@ -125,11 +127,12 @@ Anchor merge_keep_target_order_binary_heap(const std::vector<Anchor>& to_merge,
 	
 	tot_cnt += to_merge[id].data[read_pos[id]].count;
 
-	res.data.push_back(to_merge[id].data[read_pos[id]++]);
+	const auto& first = to_merge[id].data[read_pos[id]++];
+	res.add(first.barcode, target, first.sample_id, first.count);
 
 	if (read_pos[id] < to_merge[id].data.size())
 	{
-		heap[0].elem = to_merge[id].data[read_pos[id]].target;
+		heap[0].elem = to_merge[id].target(to_merge[id].data[read_pos[id]]);
 		heap_down();
 	}
 	else
@@ -147,11 +150,12 @@ Anchor merge_keep_target_order_binary_heap(const std::vector<Anchor>& to_merge,
 
 		tot_cnt += to_merge[id].data[read_pos[id]].count;
 
-		res.data.push_back(to_merge[id].data[read_pos[id]++]);
+		const auto& x = to_merge[id].data[read_pos[id]++];
+		res.add(x.barcode, new_target, x.sample_id, x.count);
 
 		if (read_pos[id] < to_merge[id].data.size())
 		{
-			heap[0].elem = to_merge[id].data[read_pos[id]].target;
+			heap[0].elem = to_merge[id].target(to_merge[id].data[read_pos[id]]);
 			heap_down();
 		}
 		else
@@ -180,6 +184,11 @@ Anchor merge_keep_target_order_binary_heap(const std::vector<Non10SingleSampleAn
 	Anchor res;
 	res.anchor = to_merge[0].anchor;
 
+	size_t n_recs = 0;
+	for (const auto& x : to_merge)
+		n_recs += x.data.size();
+	res.data.reserve(n_recs);
+
 	auto get_elem = [&](size_t id, size_t pos) {
 		return to_merge[id].data[pos].target;
 	};
@@ -196,9 +205,9 @@ Anchor merge_keep_target_order_binary_heap(const std::vector<Non10SingleSampleAn
 		cur_target = target;
 		++n_unique_targets;
 		tot_cnt += to_merge[id].data[pos].count;
-		res.data.emplace_back(
+		res.add(
 			0,
-			to_merge[id].data[pos].target,
+			target,
 			to_merge[id].sample_id,
 			to_merge[id].data[pos].count
 		);
@@ -209,9 +218,9 @@ Anchor merge_keep_target_order_binary_heap(const std::vector<Non10SingleSampleAn
 		heap.ProcessElem(get_elem, get_array_size, [&](uint64_t target, size_t id, size_t pos) {
 			tot_cnt += to_merge[id].data[pos].count;
 
-			res.data.emplace_back(
+			res.add(
 				0,
-				to_merge[id].data[pos].target,
+				target,
 				to_merge[id].sample_id,
 				to_merge[id].data[pos].count
 			);
@@ -311,7 +320,7 @@ Anchor merge_keep_target_order_binary_heap(const std::vector<Non10SingleSampleAn
 	for (const elem_t& elem : filtered) {
 		tot_cnt_kept += elem.cnt;
 		for (auto sample_id_cnt : elem.sample_ids_cnts) {
-			res.data.emplace_back(
+			res.add(
 				0,
 				elem.target,
 				sample_id_cnt.sample_id,
@@ -4,16 +4,18 @@
 #include <vector>
 #include <cinttypes>
 
+//single (sample, barcode, target) observation of an anchor, target is an index to Anchor::targets
+//sample ids, barcodes and counts fit in 32 bits (see pack_smaple_id_target and satc counter size)
 struct AnchorData {
-	uint64_t barcode;
-	uint64_t target;
-	uint64_t sample_id;
-	uint64_t count;
-	AnchorData(uint64_t barcode, uint64_t target, uint64_t sample_id, uint64_t count) :
-		barcode(barcode),
-		target(target),
-		sample_id(sample_id),
-		count(count)
+	uint32_t target_id;
+	uint32_t barcode;
+	uint32_t sample_id;
+	uint32_t count;
+	AnchorData(uint64_t barcode, uint32_t target_id, uint64_t sample_id, uint64_t count) :
+		target_id(target_id),
+		barcode(static_cast<uint32_t>(barcode)),
+		sample_id(static_cast<uint32_t>(sample_id)),
+		count(static_cast<uint32_t>(count))
 	{
 
 	}
@@ -22,7 +24,24 @@ struct AnchorData {
 struct Anchor {
 	uint64_t anchor;
 
-	std::vector<AnchorData> data;
+	std::vector<uint64_t> targets; //unique targets in increasing order
+	std::vector<AnchorData> data; //sorted by target
+
+	uint64_t target(const AnchorData& x) const {
+		return targets[x.target_id];
+	}
+
+	//adds an observation, target must not be smaller than the target of the last one
+	void add(uint64_t barcode, uint64_t target, uint64_t sample_id, uint64_t count) {
+		if (targets.empty() || targets.back() != target)
+			targets.push_back(target);
+		data.emplace_back(barcode, static_cast<uint32_t>(targets.size() - 1), sample_id, count);
+	}
+
+	void clear() {
+		targets.clear();
+		data.clear();
+	}
 };
 
 struct Non10SingleSampleAnchorData {
@@ -39,6 +58,7 @@ struct Non10SingleSampleAnchorData {
 struct Non10SingleSampleAnchor {
 	uint64_t anchor;
 	uint64_t sample_id;
+	uint64_t tot_cnt; //of all targets, to filter anchors before merging
 
 	std::vector<Non10SingleSampleAnchorData> data;
 };
@@ -79,16 +79,13 @@ void CExtraStats::condense_targets(const Anchor& anchor)
 {
 	target_counter.clear();
 
-	auto& data = anchor.data;
-	size_t size = data.size();
+	target_counter.reserve(anchor.targets.size());
 
-	target_counter.emplace_back(data.front().target, data.front().count);
+	for (auto target : anchor.targets)
+		target_counter.emplace_back(target, 0);
 
-	for (size_t i = 1; i < size; ++i)
-		if (target_counter.back().first == data[i].target)
-			target_counter.back().second += data[i].count;
-		else
-			target_counter.emplace_back(data[i].target, data[i].count);
+	for (const auto& x : anchor.data)
+		target_counter[x.target_id].second += x.count;
 }
 
 // *********************************************************************************************
@@ -364,7 +361,7 @@ size_t CExtraStats::edit_distance_dp(uint64_t x, uint64_t y)
 
 // *********************************************************************************************
 void CExtraStats::Compute(const Anchor& _anchor, size_t anchor_len_symbols, size_t target_len_symbols, size_t min_hp_len, size_t all2all_max_no_targets,
-	size_t n_uniq_targets, const std::unordered_set<uint64_t>& unique_samples, AnchorStats& anchor_stats)
+	size_t n_uniq_targets, const std::vector<uint64_t>& unique_samples, AnchorStats& anchor_stats)
 {
 	stats = anchor_stats;
 
@@ -46,7 +46,7 @@ public:
 	CExtraStats() = default;
 
 	void Compute(const Anchor& _anchor, size_t anchor_len_symbols, size_t target_len_symbols, size_t min_hp_len, size_t all2all_max_no_targets,
-		size_t n_uniq_targets, const std::unordered_set<uint64_t>& unique_samples, AnchorStats& anchor_stats);
+		size_t n_uniq_targets, const std::vector<uint64_t>& unique_samples, AnchorStats& anchor_stats);
 };
 
 
@@ -1,5 +1,4 @@
 #include <random>
-#include <unordered_map>
 #include <algorithm>
 #include <numeric>
 #include <cmath>
@@ -11,58 +10,6 @@
 #include "get_train_mtx.h"
 #include "helmert_decomposition.h"
 
-//mkokot_TODO: it would be better to just have a vector for mapping, but in the current packed representation for 10X it may not work
-class SampleToColMapper {
-	using IndexType = size_t;
-	//std::vector<IndexType> mapping;
-	std::unordered_map<uint64_t, IndexType> mapping;
-	std::vector<uint64_t> decode_mapping;
-public:
-	SampleToColMapper(const std::unordered_set<uint64_t>& unique_samples) {
-		IndexType idx = 0;
-
-		//mkokot_TODO: restore this version
-		//for (auto sample_id : unique_samples)
-		//	mapping[sample_id] = idx++;
-
-		//mkokot_TODO: remove this version
-		{
-			std::vector<uint64_t> sorted_samples(unique_samples.begin(), unique_samples.end());
-			std::sort(sorted_samples.begin(), sorted_samples.end());
-
-			decode_mapping.resize(unique_samples.size());
-
-			for (auto sample_id : sorted_samples) {
-				decode_mapping[idx] = sample_id;
-				mapping[sample_id] = idx++;
-			}
-		}
-
-		//for vector based indexing
-		//size_t max_sample_id{};
-		//for (auto sample_id : unique_samples)
-		//	if (sample_id > max_sample_id)
-		//		max_sample_id = sample_id;
-
-		//mapping.resize(max_sample_id + 1, std::numeric_limits<IndexType>::max());
-
-		//std::vector<uint64_t> sorted_samples(unique_samples.begin(), unique_samples.end());
-		//std::sort(sorted_samples.begin(), sorted_samples.end());
-		//
-		//IndexType idx = 0;
-		//for (auto sample : sorted_samples)
-		//	mapping[sample] = idx++;
-	}
-	IndexType map(uint64_t sample_id) const {
-		//return mapping[sample_id]; //cannot use because of `const`
-		return mapping.find(sample_id)->second;
-	}
-
-	uint64_t decode(IndexType index) const {
-		return decode_mapping[index];
-	}
-};
-
 bool all_values_the_same(const refresh::matrix_1d<double>& vec) {
 	for (size_t i = 1; i < vec.size(); ++i) {
 		if (vec(i) != vec(0))
@@ -604,7 +551,8 @@ void compute_stats(
 	size_t anchor_len_symbols,
 	size_t target_len_symbols,
 	size_t n_uniq_targets,
-	const std::unordered_set<uint64_t>& unique_samples,
+	const std::vector<uint64_t>& unique_samples,
+	SampleToColMapper& mapper,
 	AnchorStats& anchor_stats,
 	bool without_alt_max,
 	bool with_effect_size_cts,
@@ -634,39 +582,22 @@ void compute_stats(
 
 	std::mt19937_64 eng;
 
-	SampleToColMapper mapper(unique_samples);
+	mapper.reset(unique_samples);
 
 	//assumes targets are sorted and for each target samples are sorted
 
-	auto target = anchor.data[0].target;
-
+	//row_id is the index of the target in the target dictionary
 	std::vector<uint64_t> targets;
 
-	if (n_most_freq_targets) {
-		targets.resize(n_uniq_targets); //targets[row_id] = target associated with row_id
-		targets[0] = target;
-	}
+	if (n_most_freq_targets)
+		targets = std::move(anchor.targets); //targets[row_id] = target associated with row_id
 
 	sp_anch_contingency_table.reserve(anchor.data.size());
 
-	size_t row_id = 0;
 	for (const auto& e : anchor.data) {
-		if (target != e.target) { //new target -> new row
-			++row_id;
-			target = e.target;
-
-			if (n_most_freq_targets) {
-				targets[row_id] = target;
-			}
-		}
-
-		auto sample_id = pack_smaple_id_target(e.sample_id, e.barcode);
-
-		if (unique_samples.find(sample_id) == unique_samples.end()) {
-			std::cerr << "cannot find sample in unique set\n";
-		}
+		auto row_id = e.target_id;
 
-		auto col_id = mapper.map(sample_id);
+		auto col_id = mapper.map(e.sample_id, e.barcode);
 
 //		sp_anch_contingency_table(row_id, col_id) = e.count;
 		sp_anch_contingency_table.insert_unsafe(row_id, col_id, e.count);
@@ -674,7 +605,8 @@ void compute_stats(
 
 	sp_anch_contingency_table.fix();
 
-	anchor.data.clear();
+	anchor.clear();
+	anchor.targets.shrink_to_fit();
 	anchor.data.shrink_to_fit();
 
 	anchor_stats.sequence_entropy_anchor = std::make_pair(sequence_entropy<2>(anchor.anchor, anchor_len_symbols), sequence_entropy<3>(anchor.anchor, anchor_len_symbols));
@@ -1,11 +1,12 @@
 #ifndef _PVALS_H
 #define _PVALS_H
-#include <unordered_set>
+#include <utility>
 #include "../common/satc_data.h"
 #include "../common/cbc_to_cell_type.h"
 #include "non_10X_supervised.h"
 #include "matrix.h"
 #include "anchor.h"
+#include "unique_samples.h"
 
 
 
@@ -265,6 +266,13 @@ public:
 	}
 };
 
+struct CjEntry {
+	uint64_t anchor;
+	uint64_t sample_id;
+	uint64_t barcode;
+	double Cj;
+};
+
 class CjWriter {
 	bool _10X_or_visium;
 	uint32_t anchor_len;
@@ -272,6 +280,9 @@ class CjWriter {
 	bool enabled = false;
 	SampleNameDecoder sample_name_decoder;
 	std::ofstream out;
+	TextWriter text_out{ out };
+	bool collecting = false;
+	std::vector<CjEntry> collected;
 public:
 	CjWriter(
 		const std::string& path,
@@ -300,18 +311,41 @@ public:
 		out << "Cj\n";
 	}
 
+	//Cjs are only collected, to be written later in order (e.g. when stats of anchors are computed in parallel)
+	explicit CjWriter(bool enabled) :
+		_10X_or_visium(false),
+		anchor_len(0),
+		barcode_len(0),
+		enabled(enabled),
+		sample_name_decoder(""),
+		collecting(true) {
+	}
+
 	operator bool() const {
 		return enabled;
 	}
 
+	std::vector<CjEntry> TakeCollected() {
+		return std::exchange(collected, {});
+	}
+
+	void write(const std::vector<CjEntry>& entries) {
+		for (const auto& e : entries)
+			write(e.anchor, e.sample_id, e.barcode, e.Cj);
+	}
+
 	void write(uint64_t anchor, uint64_t sample_id, uint64_t barcode, double Cj) {
-		out << kmer_to_string(anchor, anchor_len) << "\t";
+		if (collecting) {
+			collected.push_back({ anchor, sample_id, barcode, Cj });
+			return;
+		}
+		text_out << KmerStr(anchor, anchor_len) << '\t';
 		//out << sample_id << "\t";
-		sample_name_decoder.store_sample_id(out, sample_id);
-		out << "\t";
+		sample_name_decoder.store_sample_id(text_out, sample_id);
+		text_out << '\t';
 		if (_10X_or_visium)
-			out << kmer_to_string(barcode, barcode_len) << "\t";
-		out << Cj << "\n";
+			text_out << KmerStr(barcode, barcode_len) << '\t';
+		text_out << Cj << '\n';
 	}
 };
 
@@ -321,7 +355,8 @@ void compute_stats(
 	size_t anchor_len_symbols,
 	size_t target_len_symbols,
 	size_t n_uniq_targets,
-	const std::unordered_set<uint64_t>& unique_samples,
+	const std::vector<uint64_t>& unique_samples,
+	SampleToColMapper& mapper,
 	AnchorStats &anchor_stats,
 	bool without_alt_max,
 	bool with_effect_size_cts,
@@ -9,10 +9,14 @@
 #include "pvals.h"
 #include "extra_stats.h"
 #include "../common/accepted_anchors.h"
+#include "../common/loser_tree.h"
 #include "../common/cbc_to_cell_type.h"
 #include "anchor.h"
 #include "non_10X_supervised.h"
 #include <set>
+#include <deque>
+#include <mutex>
+#include <future>
 
 class Timer {
 	using time_type = decltype(std::chrono::high_resolution_clock::now());
@@ -110,13 +114,20 @@ struct Params
 
 	std::string sample_names;
 
+	std::string temp_dict; //zstd dictionary of input bins (if compressed with satc --temp_codec zstd_dict)
+
 	std::vector<std::string> bins;
 
 	std::string dump_sample_anchor_target_count_txt;
 	std::string dump_sample_anchor_target_count_binary;
+	bool indexed_binary_dump = false;
 
 	RecFmt format = RecFmt::SATC; //only for JustMergeAndDump
 
+	uint32_t n_prefetch_threads{}; //0 means bins are decoded by the merging thread
+	uint64_t prefetch_mem_mb = 1024; //memory for decoded records of all bins (if prefetching)
+	uint32_t n_threads = 1; //threads computing stats of anchors (merging and writing is done by the main thread)
+
 	std::string cell_type_samplesheet;
 	std::string Cjs_samplesheet;
 
@@ -136,6 +147,7 @@ struct Params
 		oss << "\tcjs_out                                 : " << cjs_out << "\n";
 		oss << "\tmax_pval_opt_for_Cjs                    : " << max_pval_opt_for_Cjs << "\n";
 		oss << "\tsample_names	                          : " << sample_names << "\n";
+		oss << "\ttemp_dict                               : " << temp_dict << "\n";
 		oss << "\tn_most_freq_targets                     : " << n_most_freq_targets << "\n";
 		oss << "\tn_most_freq_targets_for_stats           : " << n_most_freq_targets_for_stats << "\n";
 		oss << "\topt_train_fraction                      : " << opt_train_fraction << "\n";
@@ -147,7 +159,11 @@ struct Params
 		oss << "\tCjs_samplesheet                         : " << Cjs_samplesheet << "\n";
 		oss << "\t dump_sample_anchor_target_count_txt    : " << dump_sample_anchor_target_count_txt << "\n";
 		oss << "\t dump_sample_anchor_target_count_binary : " << dump_sample_anchor_target_count_binary << "\n";
+		oss << "\t indexed_binary_dump                    : " << std::boolalpha << indexed_binary_dump << "\n";
 		oss << "\t format                                 : " << RecFmtConv::to_string(format) << "\n";
+		oss << "\t n_prefetch_threads                     : " << n_prefetch_threads << "\n";
+		oss << "\t prefetch_mem_mb                        : " << prefetch_mem_mb << "\n";
+		oss << "\t n_threads                              : " << n_threads << "\n";
 		oss << "\tinput bins:\n";
 		for (const auto& bin : bins)
 			oss << "\t\t" << bin << "\n";
@@ -160,7 +176,7 @@ struct Params
 		std::cerr
 			<< "Positional parameters:\n"
 			<< "    <outpath>                           - output path\n"
-			<< "    <file_with_list_of_bins_to_merge>   - file with list of paths of bins to be processed\n";
+			<< "    <file_with_list_of_bins_to_merge>   - file with list of paths of bins to be processed (<container>.bins:<bin_id> for bins stored by satc --bins_container)\n";
 		std::cerr
 			<< "Options:\n"
 			<< "    --technology <base|10x|visium>                    - sequencing technology (default: base)\n"// text file containing anchors separated by whitespaces, only anchors from this file will be dumped\n";
@@ -179,15 +195,20 @@ struct Params
 			<< "    --max_pval_opt_for_Cjs <double>                   - dump only Cjs for anchors that have pval_opt <= max_pval_opt_for_Cjs\n"
 			<< "    --dump_sample_anchor_target_count_txt <string>    - dump merged anchors in textual representation\n"
 			<< "    --dump_sample_anchor_target_count_binary <string> - dump merged anchors in textual satc format\n"
+			<< "    --indexed_binary_dump                             - binary dump is stored in indexed layout, so satc_dump --anchor_list reads only blocks containing requested anchors\n"
 			<< "    --without_alt_max                                 - disable alt max computation\n"
 			<< "    --with_effect_size_cts                            - compute effect_size_cts\n"
 			<< "    --with_pval_asymp_opt                             - compute pval_asymp_opt\n"
 			<< "    --compute_also_old_base_pvals                     - compute old base pvals\n"
 			<< "    --without_seqence_entropy                         - disable seqence entropy computation\n"
 			<< "    --sample_names <path>                             - path for decode sample id, each line should contain <sample_name> <sample_id>\n"
+			<< "    --temp_dict <path>                                - zstd dictionary input bins were compressed with (satc --temp_codec zstd_dict)\n"
 			<< "    --cell_type_samplesheet <path>                    - path for mapping barcode to cell type, is used Helmert-based supervised mode is turned on\n"
 			<< "    --Cjs_samplesheet <path>                          - path for file with predefined Cjs for non-10X supervised mode\n"
-			<< "    --format <string>                                 - output format when txt dump, available options: satc, splash (default: satc)\n";
+			<< "    --format <string>                                 - output format when txt dump, available options: satc, splash (default: satc)\n"
+			<< "    --n_prefetch_threads <int>                        - number of threads decoding input bins ahead of merging, 0 means no prefetching (default: 0)\n"
+			<< "    --prefetch_mem_mb <int>                           - memory for decoded records of all input bins when prefetching (default: 1024)\n"
+			<< "    --n_threads <int>                                 - number of threads computing stats of anchors, the output is the same as for a single thread (default: 1)\n";
 	}
 };
 
@@ -196,11 +217,14 @@ struct Stats
 {
 	uint64_t tot_filtered_out_anchors{};
 
+	uint64_t tot_input_records{}; //from stats of input bins, 0 if some bin has no stats
 	uint64_t tot_writen_anchors{};
 	uint64_t tot_writen_records{};
 	std::pair<uint64_t, uint64_t> max_contignency_matrix_size{};
 
 	void print(std::ostream& oss) {
+		if (tot_input_records)
+			oss << "tot input records                                 : " << tot_input_records << "\n";
 		oss << "tot writen anchors                                : " << tot_writen_anchors << "\n";
 		oss << "tot writen records                                : " << tot_writen_records << "\n";
 		oss << "n samples in max contignency matrix               : " << max_contignency_matrix_size.first << "\n";
@@ -296,6 +320,9 @@ Params read_params(int argc, char** argv)
 		if (param == "--sample_names") {
 			res.sample_names = argv[++i];
 		}
+		if (param == "--temp_dict") {
+			res.temp_dict = argv[++i];
+		}
 		if (param == "--cell_type_samplesheet") {
 			res.cell_type_samplesheet = argv[++i];
 		}
@@ -311,9 +338,25 @@ Params read_params(int argc, char** argv)
 		if (param == "--dump_sample_anchor_target_count_binary") {
 			res.dump_sample_anchor_target_count_binary = argv[++i];
 		}
+		if (param == "--indexed_binary_dump") {
+			res.indexed_binary_dump = true;
+		}
 
 		if (param == "--format")
 			res.format = RecFmtConv::from_string(argv[++i]);
+
+		if (param == "--n_prefetch_threads") {
+			std::string tmp = argv[++i];
+			res.n_prefetch_threads = std::stoul(tmp);
+		}
+		if (param == "--prefetch_mem_mb") {
+			std::string tmp = argv[++i];
+			res.prefetch_mem_mb = std::stoull(tmp);
+		}
+		if (param == "--n_threads") {
+			std::string tmp = argv[++i];
+			res.n_threads = std::stoul(tmp);
+		}
 	}
 	if (i >= argc) {
 		std::cerr << "Error: outpath missing\n";
@@ -354,30 +397,75 @@ Params read_params(int argc, char** argv)
 
 
 
+//records are decoded in batches, Peek and Skip only move over the current batch
+//if prefetch pool is given the next batch is decoded in the background while the current one is consumed
 class CachedRecord {
-	bool is_cached = false;
-	Record _rec{};
+	size_t batch_size;
+	RecordBatch batch;
+	size_t pos{};
 	buffered_binary_reader& in;
-public:
-	CachedRecord(buffered_binary_reader& in) :
-		in(in) {
 
+	async_task_pool* prefetch_pool;
+	RecordBatch next_batch;
+	bool next_loaded{};
+	std::future<void> pending;
+
+	void prefetch(const Header& header) {
+		pending = prefetch_pool->submit([this, &header] {
+			next_loaded = next_batch.load(in, header, batch_size);
+		});
 	}
-	bool Peek(const Header& header, Record& rec) {
-		if (is_cached) {
-			rec = _rec;
-			return true;
-		}
 
-		if (!_rec.load(in, header))
+	bool load_batch(const Header& header) {
+		pos = 0;
+		if (!prefetch_pool)
+			return batch.load(in, header, batch_size);
+
+		if (!pending.valid())
+			prefetch(header);
+		pending.get();
+		if (!next_loaded) {
+			batch.clear();
 			return false;
+		}
+		std::swap(batch, next_batch);
+		prefetch(header);
+		return true;
+	}
+public:
+	CachedRecord(buffered_binary_reader& in, async_task_pool* prefetch_pool, size_t batch_size) :
+		batch_size(batch_size),
+		in(in),
+		prefetch_pool(prefetch_pool) {
 
-		is_cached = true;
-		rec = _rec;
+	}
+	~CachedRecord() {
+		WaitForPrefetch();
+	}
+	bool Peek(const Header& header, Record& rec) {
+		if (pos == batch.size() && !load_batch(header))
+			return false;
+		batch.get(pos, rec);
 		return true;
 	}
 	void Skip() {
-		is_cached = false;
+		++pos;
+	}
+	//the input must not be touched while the next batch is decoded
+	void WaitForPrefetch() {
+		if (pending.valid())
+			pending.wait();
+	}
+	//before the first Peek
+	void SetBatchSize(size_t size) {
+		batch_size = size;
+	}
+	//records already decoded are dropped, e.g. after seeking in the input
+	void Reset() {
+		if (pending.valid())
+			pending.get();
+		batch.clear();
+		pos = 0;
 	}
 };
 
@@ -387,8 +475,10 @@ class Bin {
 	Non10SingleSampleAnchor current_anchor;
 	bool is_loaded = false;
 	CachedRecord cached_rec;
+	size_t expected_anchor_recs = 1; //from bin stats if present
 	bool load_anchor() {
 		current_anchor.data.clear();
+		current_anchor.data.reserve(expected_anchor_recs);
 		Record rec;
 
 		if (!cached_rec.Peek(header, rec))
@@ -397,10 +487,12 @@ class Bin {
 
 		current_anchor.anchor = rec.anchor;
 		current_anchor.sample_id = rec.sample_id;
+		current_anchor.tot_cnt = rec.count;
 		current_anchor.data.emplace_back(rec.target, rec.count);
 		while (cached_rec.Peek(header, rec)) {
 			assert(rec.sample_id == current_anchor.sample_id);
 			if (rec.anchor == current_anchor.anchor) {
+				current_anchor.tot_cnt += rec.count;
 				current_anchor.data.emplace_back(rec.target, rec.count);
 				cached_rec.Skip();
 			}
@@ -411,15 +503,21 @@ class Bin {
 		return true;
 	}
 public:
-	explicit Bin(const std::string& path) :
-		in(path),
-		cached_rec(in)
+	explicit Bin(const std::string& path, const TempCodec& temp_codec, async_task_pool* prefetch_pool = nullptr, size_t batch_size = 1ull << 12) :
+		in(path, 1ull << 16, temp_codec),
+		cached_rec(in, prefetch_pool, batch_size)
 	{
 		if (!in) {
 			std::cerr << "Error: cannot open file " << path << "\n";
 			exit(1);
 		}
 		header.load(in);
+		//batches are not larger than the bin and most anchors fit in the initial capacity
+		if (in.has_stats()) {
+			const auto& stats = in.get_stats();
+			cached_rec.SetBatchSize(std::clamp<size_t>(stats.n_recs, 1, batch_size));
+			expected_anchor_recs = std::max<size_t>(stats.RecsPerAnchorQuantile(0.9), 1);
+		}
 		if (!load_anchor()) {
 			std::cerr << "Warning: no anchors in " << path << "\n";
 		}
@@ -429,6 +527,11 @@ public:
 		return header;
 	}
 
+	//nullptr if the bin was stored without stats
+	const BinStats* get_stats() const {
+		return in.has_stats() ? &in.get_stats() : nullptr;
+	}
+
 	bool PeekAnchor(uint64_t& anchor)
 	{
 		if (!is_loaded) {
@@ -439,12 +542,16 @@ public:
 		return true;
 	}
 
+	//the buffer of anchor.data is taken by the bin to load the next anchor into it
 	void GetAnchor(Non10SingleSampleAnchor& anchor) {
 		if (!is_loaded) {
 			std::cerr << "Error: wrnog GetAnchor function call\n";
 			exit(1);
 		}
-		anchor = std::move(current_anchor);
+		anchor.anchor = current_anchor.anchor;
+		anchor.sample_id = current_anchor.sample_id;
+		anchor.tot_cnt = current_anchor.tot_cnt;
+		std::swap(anchor.data, current_anchor.data);
 		is_loaded = false;
 	}
 
@@ -455,11 +562,21 @@ public:
 		}
 		is_loaded = false;
 	}
+
+	//for indexed input jumps forward to the block that may contain the anchor, true if jumped
+	bool SeekToAnchor(uint64_t anchor) {
+		cached_rec.WaitForPrefetch();
+		if (!in.seek_to_anchor(anchor))
+			return false;
+		cached_rec.Reset();
+		is_loaded = false;
+		return true;
+	}
 };
 
 
 void write_out_header(
-	std::ofstream& out,
+	TextWriter& out,
 	bool without_alt_max,
 	bool with_effect_size_cts,
 	bool with_pval_asymp_opt,
@@ -553,7 +670,7 @@ void write_out_header(
 }
 
 void write_out_rec(
-	std::ofstream& out,
+	TextWriter& out,
 	const AnchorStats& anchor_stats,
 	uint64_t anchor,
 	size_t anchor_len_symbols,
@@ -573,7 +690,7 @@ void write_out_rec(
 	CBCToCellType* cbc_to_cell_type,
 	Non10XSupervised* non_10X_supervised) {
 	out
-		<< kmer_to_string(anchor, anchor_len_symbols) << "\t";
+		<< KmerStr(anchor, anchor_len_symbols) << '\t';
 
 	if (compute_also_old_base_pvals) {
 		out
@@ -684,7 +801,7 @@ void write_out_rec(
 	}
 
 	for (size_t i = 0; i < anchor_stats.most_freq_targets.size(); ++i) {
-		out << kmer_to_string(anchor_stats.most_freq_targets[i].kmer, target_len_symbols) << "\t";
+		out << KmerStr(anchor_stats.most_freq_targets[i].kmer, target_len_symbols) << '\t';
 		out << anchor_stats.most_freq_targets[i].counter << "\t";
 		if (!without_seqence_entropy) {
 			out << anchor_stats.sequence_entropy_targets[i].first << "\t";
@@ -711,6 +828,20 @@ bool anchor_filtered_out(size_t tot_cnt, size_t n_unique_targets, size_t n_uniqu
 		n_unique_samples <= params.anchor_samples_threshold;
 }
 
+//evaluated on summaries of the anchor in single samples, before their targets are merged
+//total count and numbers of unique targets and samples are upper bounds of the merged ones, so it rejects only anchors that would be filtered out after merging
+bool anchor_filtered_out(const std::vector<Non10SingleSampleAnchor>& anchors, const Params& params) {
+	size_t tot_cnt{};
+	size_t n_unique_targets{};
+	for (const auto& x : anchors) {
+		tot_cnt += x.tot_cnt;
+		n_unique_targets += x.data.size();
+	}
+	if (params.n_most_freq_targets_for_stats)
+		n_unique_targets = std::min<size_t>(n_unique_targets, params.n_most_freq_targets_for_stats);
+	return anchor_filtered_out(tot_cnt, n_unique_targets, anchors.size(), params);
+}
+
 class IAnchorProcessor {
 public:
 	virtual void ProcessAnchor(
@@ -722,13 +853,14 @@ public:
 		size_t tot_cnt,
 		size_t n_uniqe_targets_before_filter,
 		size_t tot_cnt_before_filter,
-		const std::unordered_set<uint64_t>& unique_samples) = 0;
+		const std::vector<uint64_t>& unique_samples) = 0;
 
 	virtual ~IAnchorProcessor() = default;
 };
 
 class StatsWriter : public IAnchorProcessor {
 	std::ofstream out;
+	TextWriter text_out{ out };
 	bool without_alt_max;
 	bool with_effect_size_cts;
 	bool with_pval_asymp_opt;
@@ -742,7 +874,8 @@ class StatsWriter : public IAnchorProcessor {
 	size_t num_rand_cf;
 	size_t num_splits;
 	CExtraStats extra_stats;
-	AnchorStats anchor_stats;
+	SampleToColMapper mapper;
+	AnchorStats anchor_stats; //of the last written anchor
 	CjWriter cj_writer;
 	double max_pval_opt_for_Cjs;
 	CBCToCellType* cbc_to_cell_type;
@@ -751,6 +884,132 @@ class StatsWriter : public IAnchorProcessor {
 	const size_t io_buffer_size = 1 << 20;
 	char* io_buffer;
 
+	//with n_threads > 1 stats of anchors are computed by a pool of workers
+	//and written in the order of anchors (so the output is the same as for a single thread)
+	struct Worker {
+		CExtraStats extra_stats;
+		SampleToColMapper mapper;
+		CjWriter cj_collector;
+		explicit Worker(bool with_cjs) : cj_collector(with_cjs) {}
+	};
+
+	struct PendingAnchor {
+		std::future<void> computed;
+		AnchorStats anchor_stats;
+		std::vector<CjEntry> cjs;
+		uint64_t anchor;
+		size_t anchor_len_symbols;
+		size_t target_len_symbols;
+		size_t n_uniqe_targets;
+		size_t tot_cnt;
+		size_t n_uniqe_targets_before_filter;
+		size_t tot_cnt_before_filter;
+		size_t n_unique_samples;
+	};
+
+	std::unique_ptr<async_task_pool> workers_pool;
+	std::mutex idle_workers_mtx;
+	std::vector<std::unique_ptr<Worker>> idle_workers;
+	std::deque<PendingAnchor> pending;
+	size_t max_pending{};
+
+	void compute(Anchor&& anchor,
+		bool _10X_or_visium,
+		size_t anchor_len_symbols,
+		size_t target_len_symbols,
+		size_t n_uniqe_targets,
+		const std::vector<uint64_t>& unique_samples,
+		CExtraStats& extra_stats,
+		SampleToColMapper& mapper,
+		AnchorStats& anchor_stats,
+		CjWriter& cj_writer) {
+		extra_stats.Compute(anchor, anchor_len_symbols, target_len_symbols, 5, 200, n_uniqe_targets, unique_samples, anchor_stats);
+
+		if (!_10X_or_visium || n_uniqe_targets < 1000000)
+			compute_stats(
+				std::move(anchor),
+				anchor_len_symbols,
+				target_len_symbols,
+				n_uniqe_targets,
+				unique_samples,
+				mapper,
+				anchor_stats,
+				without_alt_max,
+				with_effect_size_cts,
+				with_pval_asymp_opt,
+				compute_also_old_base_pvals,
+				n_most_freq_targets,
+				opt_train_fraction,
+				opt_num_inits,
+				opt_num_iters,
+				num_rand_cf,
+				num_splits,
+				cj_writer,
+				max_pval_opt_for_Cjs,
+				cbc_to_cell_type,
+				non_10X_supervised);
+	}
+
+	void write(uint64_t anchor,
+		size_t anchor_len_symbols,
+		size_t target_len_symbols,
+		size_t n_uniqe_targets,
+		size_t tot_cnt,
+		size_t n_uniqe_targets_before_filter,
+		size_t tot_cnt_before_filter,
+		size_t n_unique_samples) {
+		write_out_rec(
+			text_out,
+			anchor_stats,
+			anchor,
+			anchor_len_symbols,
+			target_len_symbols,
+			tot_cnt,
+			n_uniqe_targets,
+			tot_cnt_before_filter,
+			n_uniqe_targets_before_filter,
+			n_unique_samples,
+			without_alt_max,
+			with_effect_size_cts,
+			with_pval_asymp_opt,
+			compute_also_old_base_pvals,
+			is_removing_least_freq_targets_enabled,
+			without_seqence_entropy,
+			n_most_freq_targets,
+			cbc_to_cell_type,
+			non_10X_supervised);
+	}
+
+	//write computed anchors from the front of the queue, all of them if wait_all
+	void write_pending(bool wait_all) {
+		while (!pending.empty()) {
+			auto& front = pending.front();
+			if (!wait_all && pending.size() <= max_pending &&
+				front.computed.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				break;
+			front.computed.get();
+			cj_writer.write(front.cjs);
+			anchor_stats = std::move(front.anchor_stats);
+			write(front.anchor, front.anchor_len_symbols, front.target_len_symbols, front.n_uniqe_targets, front.tot_cnt,
+				front.n_uniqe_targets_before_filter, front.tot_cnt_before_filter, front.n_unique_samples);
+			pending.pop_front();
+		}
+	}
+
+	std::unique_ptr<Worker> get_idle_worker() {
+		std::lock_guard<std::mutex> lck(idle_workers_mtx);
+		if (idle_workers.empty())
+			return std::make_unique<Worker>(static_cast<bool>(cj_writer));
+		auto res = std::move(idle_workers.back());
+		idle_workers.pop_back();
+		return res;
+	}
+
+	void return_idle_worker(std::unique_ptr<Worker>&& worker) {
+		std::lock_guard<std::mutex> lck(idle_workers_mtx);
+		idle_workers.push_back(std::move(worker));
+	}
+
 public:
 	StatsWriter(
 		const std::string& outpath,
@@ -773,7 +1032,8 @@ public:
 		const std::string& sample_names,
 		double max_pval_opt_for_Cjs,
 		CBCToCellType* cbc_to_cell_type,
-		Non10XSupervised* non_10X_supervised) :
+		Non10XSupervised* non_10X_supervised,
+		uint32_t n_threads) :
 		out(outpath, std::ios_base::binary),
 //		out(outpath),
 		without_alt_max(without_alt_max),
@@ -800,8 +1060,14 @@ public:
 		io_buffer = new char[io_buffer_size];
 		out.rdbuf()->pubsetbuf(io_buffer, io_buffer_size);
 
+		if (n_threads > 1) {
+			workers_pool = std::make_unique<async_task_pool>(n_threads);
+			//anchors waiting for a slow one (e.g. with many targets) before they may be written
+			max_pending = 64 * n_threads;
+		}
+
 		write_out_header(
-			out,
+			text_out,
 			without_alt_max,
 			with_effect_size_cts,
 			with_pval_asymp_opt,
@@ -815,6 +1081,9 @@ public:
 
 	~StatsWriter()
 	{
+		write_pending(true);
+		workers_pool.reset();
+		text_out.flush();
 		out.close();
 		delete[] io_buffer;
 	}
@@ -828,56 +1097,33 @@ public:
 		size_t tot_cnt,
 		size_t n_uniqe_targets_before_filter,
 		size_t tot_cnt_before_filter,
-		const std::unordered_set<uint64_t>& unique_samples
+		const std::vector<uint64_t>& unique_samples
 	)  override {
 
 		auto _anchor = anchor.anchor;
 
-		extra_stats.Compute(anchor, anchor_len_symbols, target_len_symbols, 5, 200, n_uniqe_targets, unique_samples, anchor_stats);
-
-		if (!_10X_or_visium || n_uniqe_targets < 1000000)
-				compute_stats(
-					std::move(anchor),
-					anchor_len_symbols,
-					target_len_symbols,
-					n_uniqe_targets,
-					unique_samples,
-					anchor_stats,
-					without_alt_max,
-					with_effect_size_cts,
-					with_pval_asymp_opt,
-					compute_also_old_base_pvals,
-					n_most_freq_targets,
-					opt_train_fraction,
-					opt_num_inits,
-					opt_num_iters,
-					num_rand_cf,
-					num_splits,
-					cj_writer,
-					max_pval_opt_for_Cjs,
-					cbc_to_cell_type,
-					non_10X_supervised);
+		//stats are not computed, so the ones of the previous anchor are written
+		bool depends_on_previous = _10X_or_visium && n_uniqe_targets >= 1000000;
+
+		if (!workers_pool || depends_on_previous) {
+			write_pending(true);
+			compute(std::move(anchor), _10X_or_visium, anchor_len_symbols, target_len_symbols, n_uniqe_targets, unique_samples, extra_stats, mapper, anchor_stats, cj_writer);
+			write(_anchor, anchor_len_symbols, target_len_symbols, n_uniqe_targets, tot_cnt, n_uniqe_targets_before_filter, tot_cnt_before_filter, unique_samples.size());
+			return;
+		}
+
+		pending.push_back({ {}, {}, {}, _anchor, anchor_len_symbols, target_len_symbols, n_uniqe_targets, tot_cnt,
+			n_uniqe_targets_before_filter, tot_cnt_before_filter, unique_samples.size() });
+		auto& task = pending.back();
+		task.computed = workers_pool->submit([this, &task, _10X_or_visium, anchor = std::move(anchor), unique_samples]() mutable {
+			auto worker = get_idle_worker();
+			compute(std::move(anchor), _10X_or_visium, task.anchor_len_symbols, task.target_len_symbols, task.n_uniqe_targets, unique_samples,
+				worker->extra_stats, worker->mapper, task.anchor_stats, worker->cj_collector);
+			task.cjs = worker->cj_collector.TakeCollected();
+			return_idle_worker(std::move(worker));
+		});
 
-		write_out_rec(
-			out,
-			anchor_stats,
-			_anchor,
-			anchor_len_symbols,
-			target_len_symbols,
-			tot_cnt,
-			n_uniqe_targets,
-			tot_cnt_before_filter,
-			n_uniqe_targets_before_filter,
-			unique_samples.size(),
-			without_alt_max,
-			with_effect_size_cts,
-			with_pval_asymp_opt,
-			compute_also_old_base_pvals,
-			is_removing_least_freq_targets_enabled,
-			without_seqence_entropy,
-			n_most_freq_targets,
-			cbc_to_cell_type,
-			non_10X_supervised);
+		write_pending(false);
 	}
 };
 
@@ -894,7 +1140,9 @@ public:
 		uint8_t barcode_len_symbols,
 		uint8_t anchor_len_symbols,
 		uint8_t target_len_symbols,
-		uint8_t gap_len_symbols
+		uint8_t gap_len_symbols,
+		RecEncoding rec_encoding,
+		bool indexed
 	) :out(outpath)
 	{
 
@@ -911,6 +1159,8 @@ public:
 		out_header.anchor_len_symbols = anchor_len_symbols;
 		out_header.target_len_symbols = target_len_symbols;
 		out_header.gap_len_symbols = gap_len_symbols;
+		out_header.encoding = rec_encoding;
+		out_header.indexed = indexed;
 
 		out_header.serialize(out);
 	}
@@ -923,7 +1173,7 @@ public:
 			rec.barcode = x.barcode;
 			rec.count = x.count;
 			rec.sample_id = x.sample_id;
-			rec.target = x.target;
+			rec.target = anchor.target(x);
 
 			rec.serialize(out, out_header);
 		}
@@ -938,17 +1188,17 @@ public:
 		size_t tot_cnt,
 		size_t n_uniqe_targets_before_filter,
 		size_t tot_cnt_before_filter,
-		const std::unordered_set<uint64_t>& unique_samples
+		const std::vector<uint64_t>& unique_samples
 	)  override {
 		ProcessAnchor(anchor);
 
-		anchor.data.clear();
-		anchor.data.shrink_to_fit();
+		anchor.clear();
 	}
 };
 
 class SatcDumpWriter : public IAnchorProcessor {
 	std::ofstream out;
+	TextWriter text_out{ out };
 	Header header;
 	RecFmt format;
 	SampleNameDecoder sample_name_decoder;
@@ -994,9 +1244,9 @@ public:
 			rec.barcode = x.barcode;
 			rec.count = x.count;
 			rec.sample_id = x.sample_id;
-			rec.target = x.target;
+			rec.target = anchor.target(x);
 
-			rec.print(out, header, format, sample_name_decoder);
+			rec.print(text_out, header, format, sample_name_decoder);
 		}
 	}
 
@@ -1009,12 +1259,11 @@ public:
 		size_t tot_cnt,
 		size_t n_uniqe_targets_before_filter,
 		size_t tot_cnt_before_filter,
-		const std::unordered_set<uint64_t>& unique_samples
+		const std::vector<uint64_t>& unique_samples
 	) override {
 		ProcessAnchor(anchor);
 
-		anchor.data.clear();
-		anchor.data.shrink_to_fit();
+		anchor.clear();
 	}
 };
 
@@ -1045,7 +1294,7 @@ public:
 		size_t tot_cnt,
 		size_t n_uniqe_targets_before_filter,
 		size_t tot_cnt_before_filter,
-		const std::unordered_set<uint64_t>& unique_samples
+		const std::vector<uint64_t>& unique_samples
 	)  override {
 		if (satc_dump_writer)
 			satc_dump_writer->ProcessAnchor(anchor);
@@ -1067,35 +1316,113 @@ public:
 	}
 };
 
-bool get_top_anchors(std::vector<std::unique_ptr<Bin>>& bins, AcceptedAnchors& anchor_filter, std::vector<uint64_t>& top_anchors) {
-	for (size_t bin_id = 0; bin_id < bins.size(); ++bin_id) {
-		uint64_t anchor;
-		if (!bins[bin_id]->PeekAnchor(anchor)) {
-			bins[bin_id--] = std::move(bins.back());
-			bins.pop_back();
+//false if there are no more accepted anchors in the bin
+bool peek_accepted_anchor(Bin& bin, AcceptedAnchors& anchor_filter, uint64_t& anchor) {
+	while (true) {
+		if (!bin.PeekAnchor(anchor))
+			return false;
+		if (anchor_filter.IsAccepted(anchor))
+			return true;
+		uint64_t next_accepted;
+		if (!anchor_filter.GetNextAccepted(anchor, next_accepted))
+			return false;
+		if (!bin.SeekToAnchor(next_accepted))
+			bin.Skip();
+	}
+}
+
+//k-way merge of bins by anchor, the next anchor and the bins containing it are found with a loser tree in O(k log n_bins)
+//anchors of bins are given in the order of a linear scan over a vector of bins in which an exhausted bin is replaced by the last one
+//(the order of the merge before the loser tree was used), so the records of equal targets are merged in the same order as before
+class BinsMerger {
+	std::vector<std::unique_ptr<Bin>>& bins;
+	AcceptedAnchors& anchor_filter;
+	std::unique_ptr<LoserTree<uint64_t>> tree;
+
+	std::vector<size_t> scan_order; //bin ids in the order of the scan
+	std::vector<size_t> scan_pos; //position of a bin in scan_order
+	std::vector<bool> exhausted;
+	std::vector<size_t> exhausted_pos;
+	std::vector<std::pair<size_t, Non10SingleSampleAnchor>> pos_anchors;
+	std::vector<std::vector<Non10SingleSampleAnchorData>> spare_data; //buffers of already merged anchors to be reused by bins
+	static constexpr size_t max_spare_data_size = 1ull << 16; //larger buffers are released
+
+	//as if bins were removed from scan_order during the scan
+	void remove_exhausted() {
+		std::sort(exhausted_pos.begin(), exhausted_pos.end());
+		for (auto pos : exhausted_pos)
+			while (pos < scan_order.size() && exhausted[scan_order[pos]]) {
+				bins[scan_order[pos]].reset();
+				scan_order[pos] = scan_order.back();
+				scan_pos[scan_order[pos]] = pos;
+				scan_order.pop_back();
+			}
+		exhausted_pos.clear();
+	}
+public:
+	BinsMerger(std::vector<std::unique_ptr<Bin>>& bins, AcceptedAnchors& anchor_filter) :
+		bins(bins),
+		anchor_filter(anchor_filter),
+		scan_order(bins.size()),
+		scan_pos(bins.size()),
+		exhausted(bins.size()) {
+		std::vector<uint64_t> anchors(bins.size());
+		std::vector<bool> active(bins.size());
+		for (size_t bin_id = 0; bin_id < bins.size(); ++bin_id) {
+			scan_order[bin_id] = scan_pos[bin_id] = bin_id;
+			active[bin_id] = peek_accepted_anchor(*bins[bin_id], anchor_filter, anchors[bin_id]);
+			if (!active[bin_id]) {
+				exhausted[bin_id] = true;
+				exhausted_pos.push_back(bin_id);
+			}
 		}
-		else {
-			if (anchor_filter.IsAccepted(anchor))
-				top_anchors.push_back(anchor);
-			else { //skip this anchor
-				while (true) {
-					bins[bin_id]->Skip();
-					uint64_t new_anchor;
-					if (!bins[bin_id]->PeekAnchor(new_anchor)) {
-						bins[bin_id--] = std::move(bins.back());
-						bins.pop_back();
-						break;
-					}
-					else if (new_anchor != anchor) {
-						--bin_id;
-						break;
-					}
-				}
+		remove_exhausted();
+		tree = std::make_unique<LoserTree<uint64_t>>(std::move(anchors), std::move(active));
+	}
+
+	//false if all bins are exhausted
+	//anchors from the previous call are recycled
+	bool GetNextAnchors(std::vector<Non10SingleSampleAnchor>& anchors) {
+		for (auto& x : anchors)
+			if (x.data.capacity() <= max_spare_data_size) {
+				x.data.clear();
+				spare_data.emplace_back(std::move(x.data));
+			}
+		anchors.clear();
+		if (tree->Empty())
+			return false;
+
+		uint64_t min_anchor = tree->WinnerKey();
+		while (!tree->Empty() && tree->WinnerKey() == min_anchor) {
+			auto bin_id = tree->Winner();
+			pos_anchors.emplace_back();
+			pos_anchors.back().first = scan_pos[bin_id];
+			if (!spare_data.empty()) {
+				pos_anchors.back().second.data = std::move(spare_data.back());
+				spare_data.pop_back();
+			}
+			bins[bin_id]->GetAnchor(pos_anchors.back().second);
+
+			uint64_t next_anchor;
+			if (peek_accepted_anchor(*bins[bin_id], anchor_filter, next_anchor))
+				tree->UpdateWinner(next_anchor);
+			else {
+				tree->DeactivateWinner();
+				exhausted[bin_id] = true;
+				exhausted_pos.push_back(scan_pos[bin_id]);
 			}
 		}
+		remove_exhausted();
+
+		std::sort(pos_anchors.begin(), pos_anchors.end(), [](const auto& lhs, const auto& rhs) {
+			return lhs.first < rhs.first;
+		});
+		for (auto& x : pos_anchors)
+			anchors.emplace_back(std::move(x.second));
+		pos_anchors.clear();
+		return true;
 	}
-	return !bins.empty();
-}
+};
 
 std::unique_ptr<IAnchorProcessor> get_anchor_processor(
 	const std::string& outpath,
@@ -1111,6 +1438,8 @@ std::unique_ptr<IAnchorProcessor> get_anchor_processor(
 	uint8_t anchor_len_symbols,
 	uint8_t target_len_symbols,
 	uint8_t gap_len_symbols,
+	RecEncoding rec_encoding,
+	bool indexed_binary_dump,
 	const std::string& sample_names,
 	bool without_alt_max,
 	bool with_effect_size_cts,
@@ -1128,7 +1457,8 @@ std::unique_ptr<IAnchorProcessor> get_anchor_processor(
 	bool _10X_or_visium,
 	double max_pval_opt_for_Cjs,
 	CBCToCellType* cbc_to_cell_type,
-	Non10XSupervised* non_10X_supervised) {
+	Non10XSupervised* non_10X_supervised,
+	uint32_t n_threads) {
 
 	std::unique_ptr<SatcDumpWriter> satc_dump_writer;
 
@@ -1162,7 +1492,9 @@ std::unique_ptr<IAnchorProcessor> get_anchor_processor(
 			barcode_len_symbols,
 			anchor_len_symbols,
 			target_len_symbols,
-			gap_len_symbols
+			gap_len_symbols,
+			rec_encoding,
+			indexed_binary_dump
 			);
 	}
 
@@ -1187,7 +1519,8 @@ std::unique_ptr<IAnchorProcessor> get_anchor_processor(
 		sample_names,
 		max_pval_opt_for_Cjs,
 		cbc_to_cell_type,
-		non_10X_supervised);
+		non_10X_supervised,
+		n_threads);
 
 	return std::make_unique<CombinedAnchorWriter>(
 		std::move(satc_dump_writer),
@@ -1195,6 +1528,14 @@ std::unique_ptr<IAnchorProcessor> get_anchor_processor(
 		std::move(stats_writer));
 }
 
+//AnchorData keeps sample ids, barcodes and counts in 32 bits
+void check_anchor_data_fields(const Header& header, const std::string& path) {
+	if (header.sample_id_size_bytes > 4 || header.barcode_size_bytes > 4 || header.counter_size_bytes > 4) {
+		std::cerr << "Error: sample ids, barcodes and counters of " << path << " must fit in 4 bytes\n";
+		exit(1);
+	}
+}
+
 void run_non_10X(const Params& params) {
 	AcceptedAnchors anchor_filter(params.anchor_list);
 
@@ -1207,11 +1548,35 @@ void run_non_10X(const Params& params) {
 		non_10X_supervised = std::make_unique<Non10XSupervised>(params.Cjs_samplesheet, SampleNameToId(params.sample_names));
 	}
 
+	TempCodec temp_codec(TempCodecType::zstd, 9, params.temp_dict);
+
+	//each bin holds the current and the next batch, 5 fields of 8 bytes per record
+	std::unique_ptr<async_task_pool> prefetch_pool;
+	size_t batch_size = 1ull << 12;
+	if (params.n_prefetch_threads) {
+		prefetch_pool = std::make_unique<async_task_pool>(params.n_prefetch_threads);
+		batch_size = (params.prefetch_mem_mb << 20) / (params.bins.size() * 2 * 5 * sizeof(uint64_t));
+		batch_size = std::clamp<size_t>(batch_size, 1ull << 6, 1ull << 16);
+		//with anchor list indexed bins are read by jumps, so records decoded ahead are mostly dropped
+		if (!anchor_filter.AcceptsAll())
+			batch_size = std::min<size_t>(batch_size, 1ull << 12);
+	}
+
 	std::vector<std::unique_ptr<Bin>> bins;
 	for (auto& path : params.bins)
-		bins.emplace_back(std::make_unique<Bin>(path));
+		bins.emplace_back(std::make_unique<Bin>(path, temp_codec, prefetch_pool.get(), batch_size));
 
 	Stats stats;
+	for (auto& bin : bins) {
+		if (!bin->get_stats()) {
+			stats.tot_input_records = 0;
+			break;
+		}
+		stats.tot_input_records += bin->get_stats()->n_recs;
+	}
+
+	for (size_t i = 0; i < bins.size(); ++i)
+		check_anchor_data_fields(bins[i]->get_header(), params.bins[i]);
 
 	const auto bin0_header = bins[0]->get_header();
 	uint8_t max_sample_id_size_bytes = bin0_header.sample_id_size_bytes;
@@ -1251,6 +1616,8 @@ void run_non_10X(const Params& params) {
 		bin0_header.anchor_len_symbols,
 		bin0_header.target_len_symbols,
 		bin0_header.gap_len_symbols,
+		bin0_header.encoding,
+		params.indexed_binary_dump,
 		params.sample_names,
 		params.without_alt_max,
 		params.with_effect_size_cts,
@@ -1268,29 +1635,21 @@ void run_non_10X(const Params& params) {
 		false,
 		params.max_pval_opt_for_Cjs,
 		nullptr,
-		non_10X_supervised.get()
+		non_10X_supervised.get(),
+		params.n_threads
 	);
 
-	std::vector<uint64_t> top_anchors;
+	BinsMerger bins_merger(bins, anchor_filter);
+	std::vector<Non10SingleSampleAnchor> anchors;
+	UniqueSamples unique_sample_ids;
 
-	while (true) {
-		top_anchors.clear();
-
-		if (!get_top_anchors(bins, anchor_filter, top_anchors))
-			break;
-
-		uint64_t min_anchor = *std::min_element(top_anchors.begin(), top_anchors.end());
-
-		//merge all anchors that are min		
-		std::vector<Non10SingleSampleAnchor> anchors;
-		for (size_t i = 0; i < top_anchors.size(); ++i) {
-			if (top_anchors[i] == min_anchor) {
-				Non10SingleSampleAnchor anch;
-				bins[i]->GetAnchor(anch);
-				anch.data.shrink_to_fit();
-				anchors.emplace_back(std::move(anch));
-			}
+	//merge all anchors that are min
+	while (bins_merger.GetNextAnchors(anchors)) {
+		if (anchor_filtered_out(anchors, params)) {
+			++stats.tot_filtered_out_anchors;
+			continue;
 		}
+
 		uint64_t n_unique_targets{};
 		uint64_t tot_cnt{};
 
@@ -1300,13 +1659,10 @@ void run_non_10X(const Params& params) {
 		//Anchor merged = merge_keep_target_order(anchors, n_unique_targets, tot_cnt);
 		Anchor merged = merge_keep_target_order_binary_heap(anchors, params.n_most_freq_targets_for_stats, n_unique_targets, tot_cnt, n_unique_targets_kept, tot_cnt_kept);
 
-		anchors.clear();
-		anchors.shrink_to_fit();
-
 		//consider better filtering
-		std::unordered_set<uint64_t> unique_sample_ids;
+		unique_sample_ids.clear();
 		for (const auto& x : merged.data)
-			unique_sample_ids.insert(pack_smaple_id_target(x.sample_id, 0)); //mkokot_TODO: for 10X compatibility, not the most elegant solution
+			unique_sample_ids.add(x.sample_id, 0);
 
 		if (anchor_filtered_out(tot_cnt_kept, n_unique_targets_kept, unique_sample_ids.size(), params)) {
 			++stats.tot_filtered_out_anchors;
@@ -1316,7 +1672,7 @@ void run_non_10X(const Params& params) {
 		++stats.tot_writen_anchors;
 		stats.tot_writen_records += merged.data.size();
 
-		anchor_processor->ProcessAnchor(std::move(merged), false, bin0_header.anchor_len_symbols, bin0_header.target_len_symbols, n_unique_targets_kept, tot_cnt_kept, n_unique_targets, tot_cnt, unique_sample_ids);
+		anchor_processor->ProcessAnchor(std::move(merged), false, bin0_header.anchor_len_symbols, bin0_header.target_len_symbols, n_unique_targets_kept, tot_cnt_kept, n_unique_targets, tot_cnt, unique_sample_ids.get());
 
 		if (stats.max_contignency_matrix_size.first * stats.max_contignency_matrix_size.second < unique_sample_ids.size() * n_unique_targets_kept) {
 			stats.max_contignency_matrix_size.first = unique_sample_ids.size();
@@ -1350,13 +1706,15 @@ void run_10X_or_visium(const Params& params) {
 		cbc_to_cell_type = std::make_unique<CBCToCellType>(params.cell_type_samplesheet, SampleNameToId(params.sample_names));
 	}
 
+	TempCodec temp_codec(TempCodecType::zstd, 9, params.temp_dict);
 	for (const auto& path : params.bins) {
-		buffered_binary_reader in(path);
+		buffered_binary_reader in(path, 1ull << 16, temp_codec);
 		if (!in) {
 			std::cerr << "Error: cannot open file " << path << "\n";
 			exit(1);
 		}
 		header.load(in);
+		check_anchor_data_fields(header, path);
 		if (anchor_len_symbols == 0)
 			anchor_len_symbols = header.anchor_len_symbols;
 		else if (anchor_len_symbols != header.anchor_len_symbols) {
@@ -1423,6 +1781,8 @@ void run_10X_or_visium(const Params& params) {
 		header.anchor_len_symbols,
 		header.target_len_symbols,
 		header.gap_len_symbols,
+		header.encoding,
+		params.indexed_binary_dump,
 		params.sample_names,
 		params.without_alt_max,
 		params.with_effect_size_cts,
@@ -1440,7 +1800,8 @@ void run_10X_or_visium(const Params& params) {
 		true,
 		params.max_pval_opt_for_Cjs,
 		cbc_to_cell_type.get(),
-		nullptr
+		nullptr,
+		params.n_threads
 	);
 
 	if (all_records.empty()) {
@@ -1464,7 +1825,7 @@ void run_10X_or_visium(const Params& params) {
 
 	Anchor anchor;
 
-	std::unordered_set<uint64_t> unique_sample_ids;
+	UniqueSamples unique_sample_ids;
 	size_t n_unique_targets;
 
 	uint64_t prev_target;
@@ -1473,15 +1834,15 @@ void run_10X_or_visium(const Params& params) {
 
 	auto start_new_anchor = [&](size_t i) {
 		const auto& rec = all_records[i];
-		anchor.data.clear();
+		anchor.clear();
 		anchor.anchor = rec.anchor;
-		anchor.data.emplace_back(
+		anchor.add(
 			rec.barcode,
 			rec.target,
 			rec.sample_id,
 			rec.count);
 		unique_sample_ids.clear();
-		unique_sample_ids.insert(pack_smaple_id_target(rec.sample_id, rec.barcode));
+		unique_sample_ids.add(rec.sample_id, rec.barcode);
 
 		n_unique_targets = 1;
 
@@ -1494,7 +1855,7 @@ void run_10X_or_visium(const Params& params) {
 		if (!anchor_filtered_out(tot_cnt, n_unique_targets, unique_sample_ids.size(), params)) {
 
 			//std::cout << kmer_to_string(anchor.anchor, anchor_len_symbols) << std::endl;
-			anchor_processor->ProcessAnchor(std::move(anchor), true, anchor_len_symbols, target_len_symbols, n_unique_targets, tot_cnt, n_unique_targets, tot_cnt, unique_sample_ids); //mkokot_TODO: add code to keep only n_most_freq_targets_for_stats targets
+			anchor_processor->ProcessAnchor(std::move(anchor), true, anchor_len_symbols, target_len_symbols, n_unique_targets, tot_cnt, n_unique_targets, tot_cnt, unique_sample_ids.get()); //mkokot_TODO: add code to keep only n_most_freq_targets_for_stats targets
 		}
 		else
 			++stats.tot_filtered_out_anchors;
@@ -1510,9 +1871,9 @@ void run_10X_or_visium(const Params& params) {
 		}
 		tot_cnt += rec.count;
 
-		unique_sample_ids.emplace(pack_smaple_id_target(rec.sample_id, rec.barcode));
+		unique_sample_ids.add(rec.sample_id, rec.barcode);
 
-		anchor.data.emplace_back(
+		anchor.add(
 			rec.barcode,
 			rec.target,
 			rec.sample_id,
@@ -0,0 +1,101 @@
+#ifndef _UNIQUE_SAMPLES_H
+#define _UNIQUE_SAMPLES_H
+
+#include <vector>
+#include <algorithm>
+#include <cinttypes>
+#include "../common/satc_data.h"
+
+//unique (packed) sample ids of an anchor, i.e., columns of its contingency table
+//reused for all anchors: sample ids are deduplicated with an array of generation stamps indexed with sample id, so clear() is O(1)
+//(sample id, barcode) pairs with a barcode (10X) are deduplicated by sorting
+class UniqueSamples {
+	std::vector<uint64_t> samples;
+	std::vector<uint32_t> stamps; //stamps[sample_id] == generation if sample is already in samples
+	uint32_t generation = 1;
+	bool with_barcodes{};
+	bool sorted = true;
+
+	void sort_unique() {
+		if (sorted)
+			return;
+		std::sort(samples.begin(), samples.end());
+		if (with_barcodes)
+			samples.erase(std::unique(samples.begin(), samples.end()), samples.end());
+		sorted = true;
+	}
+public:
+	void clear() {
+		samples.clear();
+		with_barcodes = false;
+		sorted = true;
+		if (++generation == 0) {
+			std::fill(stamps.begin(), stamps.end(), 0);
+			generation = 1;
+		}
+	}
+
+	void add(uint64_t sample_id, uint64_t barcode) {
+		sorted = false;
+		if (barcode) {
+			with_barcodes = true;
+			samples.push_back(pack_smaple_id_target(sample_id, barcode));
+			return;
+		}
+		if (sample_id >= stamps.size())
+			stamps.resize(sample_id + 1);
+		if (stamps[sample_id] == generation)
+			return;
+		stamps[sample_id] = generation;
+		samples.push_back(pack_smaple_id_target(sample_id, 0));
+	}
+
+	size_t size() {
+		if (with_barcodes)
+			sort_unique();
+		return samples.size();
+	}
+
+	//in increasing order
+	const std::vector<uint64_t>& get() {
+		sort_unique();
+		return samples;
+	}
+};
+
+//maps (packed) sample id to the column of the contingency table, columns are in the order of unique samples
+//reused for all anchors: without barcodes it is a dense array indexed with sample id, otherwise a binary search
+class SampleToColMapper {
+	using IndexType = size_t;
+	std::vector<uint32_t> cols;
+	const std::vector<uint64_t>* samples{};
+	bool dense{};
+public:
+	//unique_samples must be sorted and must live as long as the mapping is used
+	void reset(const std::vector<uint64_t>& unique_samples) {
+		samples = &unique_samples;
+		dense = std::none_of(unique_samples.begin(), unique_samples.end(), [](uint64_t x) {
+			uint64_t sample_id, barcode;
+			unpack_sample_id_target(x, sample_id, barcode);
+			return barcode != 0;
+		});
+		if (!dense || unique_samples.empty())
+			return;
+		if ((unique_samples.back() >> 32) >= cols.size())
+			cols.resize((unique_samples.back() >> 32) + 1);
+		for (size_t i = 0; i < unique_samples.size(); ++i)
+			cols[unique_samples[i] >> 32] = static_cast<uint32_t>(i);
+	}
+
+	IndexType map(uint64_t sample_id, uint64_t barcode) const {
+		if (dense)
+			return cols[sample_id];
+		return std::lower_bound(samples->begin(), samples->end(), pack_smaple_id_target(sample_id, barcode)) - samples->begin();
+	}
+
+	uint64_t decode(IndexType index) const {
+		return (*samples)[index];
+	}
+};
+
+#endif // _UNIQUE_SAMPLES_H
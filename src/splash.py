@@ -98,9 +98,19 @@ group_technical.add_argument("--n_threads_stage_1", default=0, type=int, help="n
 group_technical.add_argument("--n_threads_stage_1_internal", default=0, type=int, help="number of threads per each stage 1 thread  (0 means auto adjustment)")
 group_technical.add_argument("--n_threads_stage_1_internal_boost", default=1, type=int, help="multiply the value of n_threads_stage_1_internal by this (may increase performance but the total number of running threads may be high)")
 group_technical.add_argument("--n_threads_stage_2", default=0, type=int, help="number of threads for the second stage, high value is recommended if possible, single thread will process single bin (0 means auto adjustment)")
+group_technical.add_argument("--n_threads_stage_2_internal", default=0, type=int, help="number of threads computing stats of anchors in each second stage thread, useful if there are less bins than CPUs (0 means auto adjustment)")
+group_technical.add_argument("--n_prefetch_threads_stage_2", default=0, type=int, help="number of threads decoding input bins ahead of merging in each second stage thread, may help if there are many samples and less bins than CPUs (0 means no prefetching)")
 group_technical.add_argument("--n_bins", default=128, type=int, help="the data will be split in a number of bins that will be merged later")
 group_technical.add_argument("--kmc_use_RAM_only_mode", default=False, action='store_true', help="True here may increase performance but also RAM-usage")
 group_technical.add_argument("--kmc_max_mem_GB", default=12, type=int, help="maximal amount of memory (in GB) KMC will try to not extend")
+group_technical.add_argument("--without_kmc", default=False, action='store_true', help="if set satc counts anchor-target pairs directly from fastq/fasta input instead of running kmc and kmc_tools (faster and less disk traffic, but the whole sample is counted in RAM)")
+group_technical.add_argument("--bins_rec_encoding", default="prefix_diff", type=str, choices=["prefix_diff", "bit_packed", "columnar"], help="encoding of records in intermediate bins, bit_packed and columnar are more compact, prefix_diff is readable by older satc_dump and satc_merge (without --heavy_bins_first) and is currently faster to merge")
+group_technical.add_argument("--heavy_bins_first", default=False, action='store_true', help="if set record statistics are stored at the end of intermediate bins and the second stage processes bins with the most records first (bins are then not readable by older satc_dump and satc_merge)")
+group_technical.add_argument("--bins_container", default=False, action='store_true', help="if set all bins of a sample are stored in a single file instead of n_bins files (much less files for large cohorts, but bins are removed only after the whole second stage)")
+group_technical.add_argument("--temp_codec", default="zstd", type=str, choices=["none", "zstd", "zstd_dict", "ram"], help="codec of intermediate bins, none is the fastest but bins are the largest, zstd_dict trains a compression dictionary on bins of the first samples and uses it for the rest of samples, ram stores not compressed bins in /dev/shm (tmp_dir is still used for other files)")
+group_technical.add_argument("--temp_ram_budget_GB", default=0, type=float, help="for ram temp_codec, maximal size of bins stored in /dev/shm, bins of samples that would exceed it (estimated from the input size when the sample is started) are stored in tmp_dir compressed with zstd (0 means no limit)")
+group_technical.add_argument("--temp_codec_level", default=9, type=int, help="zstd compression level of intermediate bins (for zstd and zstd_dict temp_codec)")
+group_technical.add_argument("--cohort_prescreen", default=False, action='store_true', help="if set stage 1 is run twice, the first pass only collects anchor statistics of all samples, so the second pass does not store anchors that would be filtered out in stage 2 by anchor_count_threshold, anchor_unique_targets_threshold and anchor_samples_threshold (smaller bins, but input is processed twice)")
 group_technical.add_argument("--dont_clean_up", default=False, action='store_true', help="if set then intermediate files will not be removed")
 group_technical.add_argument("--logs_dir", default="logs", type=str, help="director where run logs of each thread will be stored")
 
@@ -115,6 +125,8 @@ n_threads_stage_1 = args.n_threads_stage_1
 n_threads_stage_1_internal = args.n_threads_stage_1_internal
 n_threads_stage_1_internal_boost = args.n_threads_stage_1_internal_boost
 n_threads_stage_2 = args.n_threads_stage_2
+n_threads_stage_2_internal = args.n_threads_stage_2_internal
+n_prefetch_threads_stage_2 = args.n_prefetch_threads_stage_2
 anchor_list = args.anchor_list
 n_bins = args.n_bins
 anchor_len = args.anchor_len
@@ -136,6 +148,14 @@ num_splits=args.num_splits
 opt_train_fraction=args.opt_train_fraction
 kmc_use_RAM_only_mode = args.kmc_use_RAM_only_mode
 kmc_max_mem_GB = args.kmc_max_mem_GB
+without_kmc = args.without_kmc
+bins_rec_encoding = args.bins_rec_encoding
+bins_container = args.bins_container
+heavy_bins_first = args.heavy_bins_first
+temp_codec = args.temp_codec
+temp_codec_level = args.temp_codec_level
+temp_ram_budget_GB = args.temp_ram_budget_GB
+cohort_prescreen = args.cohort_prescreen
 without_alt_max = args.without_alt_max
 with_effect_size_cts = args.with_effect_size_cts
 with_pval_asymp_opt = args.with_pval_asymp_opt
@@ -186,6 +206,22 @@ if supervised_test_samplesheet != "":
 if tmp_dir == "":
     tmp_dir="splash-tmp-"+uuid.uuid4().hex
 
+# intermediate bins are stored in bins_dir (sketches of the cohort pre-screen are always stored in tmp_dir)
+bins_dir = tmp_dir
+if temp_codec == "ram":
+    if not os.path.isdir("/dev/shm"):
+        print("Error: --temp_codec ram requires /dev/shm")
+        sys.exit(1)
+    bins_dir = "/dev/shm/splash-bins-"+uuid.uuid4().hex
+elif temp_ram_budget_GB != 0:
+    print("Warning: --temp_ram_budget_GB is used only with --temp_codec ram")
+
+# samples whose bins did not fit in temp_ram_budget_GB, they are stored in tmp_dir
+spilled_samples = set()
+
+def get_sample_bins_dir(sample_name):
+    return tmp_dir if sample_name in spilled_samples else bins_dir
+
 max_cpus_to_use_in_auto_adjust = min(multiprocessing.cpu_count(), 64)
 
 if n_threads_stage_1 == 0 and n_threads_stage_1_internal == 0:
@@ -229,6 +265,11 @@ if n_threads_stage_2 == 0:
     n_threads_stage_2 = max_cpus_to_use_in_auto_adjust
     print(f"n_threads_stage_2 auto adjusted to {n_threads_stage_2}", flush=True)
 
+# CPUs not used because there are less bins than stage 2 threads are used inside of satc_merge
+if n_threads_stage_2_internal == 0:
+    n_threads_stage_2_internal = max(1, max_cpus_to_use_in_auto_adjust // min(n_threads_stage_2, n_bins))
+    print(f"n_threads_stage_2_internal auto adjusted to {n_threads_stage_2_internal}", flush=True)
+
 def get_gap_len_from_the_data():
     def get_first_line_from_txt_file(path):
         try:
@@ -370,6 +411,8 @@ with open(input_file) as f:
         inputs.append([path, sample_id])
 
 os.makedirs(tmp_dir)
+if bins_dir != tmp_dir:
+    os.makedirs(bins_dir)
 
 def get_extension_gz_aware(path):
     base, ext = os.path.splitext(path)
@@ -480,12 +523,130 @@ timer = Timer()
 print("Starting stage 1")
 print("Current time:", get_cur_time(), flush=True)
 
+# anchor list is used already in stage 1, so only listed anchors are stored in bins
+if len(anchor_list):
+    anchor_list_param = f"--anchor_list {anchor_list}"
+else:
+    anchor_list_param=""
+
+# 0 - no cohort pre-screen, 1 - first pass (only sketches are built), 2 - second pass (bins are filtered with the cohort sketch)
+stage_1_pass = 0
+cohort_sketch_path = f"{tmp_dir}/cohort.sketch"
+
+def get_cohort_prescreen_param():
+    if stage_1_pass == 1:
+        return "--build_sketch"
+    if stage_1_pass == 2:
+        return f"--cohort_sketch {cohort_sketch_path} \
+            --cohort_anchor_count_threshold {anchor_count_threshold} \
+            --cohort_anchor_unique_targets_threshold {anchor_unique_targets_threshold} \
+            --cohort_anchor_samples_threshold {anchor_samples_threshold}"
+    return ""
+
+# for zstd_dict bins of the first samples are compressed without a dictionary, the dictionary is trained on them
+stage_1_temp_codec = "none" if temp_codec == "ram" else "zstd"
+temp_dict_path = f"{tmp_dir}/temp.dict"
+
+# bins of samples that did not fit in temp_ram_budget_GB are compressed
+def get_temp_codec_param(sample_name = None):
+    codec = "zstd" if sample_name in spilled_samples else stage_1_temp_codec
+    res = f"--temp_codec {codec} --temp_codec_level {temp_codec_level}"
+    if codec == "zstd_dict":
+        res += f" --temp_dict {temp_dict_path}"
+    if bins_container:
+        res += " --bins_container"
+    if heavy_bins_first:
+        res += " --bin_stats"
+    return res
+
+# path of a bin of a sample written in stage 1
+def get_bin_path(sample_name, bin_id):
+    if bins_container:
+        return f"{get_sample_bins_dir(sample_name)}/{sample_name}.bins:{bin_id}"
+    return f"{get_sample_bins_dir(sample_name)}/{sample_name}.{bin_id}.bin"
+
+# number of records of each bin of a sample (from stats footers written by satc --bin_stats), zeros if unknown
+def get_bins_n_recs(sample_name):
+    list_path = f"{tmp_dir}/{sample_name}.bins_list.txt"
+    n_recs_path = f"{tmp_dir}/{sample_name}.bins_n_recs.txt"
+    with open(list_path, "w") as f:
+        for bin_id in range(n_bins):
+            f.write(get_bin_path(sample_name, bin_id) + "\n")
+    _temp_dict_param = f"--temp_dict {temp_dict_path}" if stage_1_temp_codec == "zstd_dict" else ""
+    cmd = f"{satc_dump} --stats_only {_temp_dict_param} --n_bins {n_bins} {list_path} {n_recs_path}"
+    res = [0] * n_bins
+    if subprocess.run(cmd, shell=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode == 0:
+        with open(n_recs_path) as f:
+            res = [int(line) for line in f]
+        os.remove(n_recs_path)
+    os.remove(list_path)
+    return res
+
+# output of satc for a sample (sketches of the first pass of the cohort pre-screen are not counted in temp_ram_budget_GB)
+def get_sample_out_base(sample_name):
+    if stage_1_pass == 1:
+        return f"{tmp_dir}/{sample_name}"
+    return f"{get_sample_bins_dir(sample_name)}/{sample_name}"
+
 def stage_1_task(id, input, out, err):
+    _cohort_prescreen_param = get_cohort_prescreen_param()
+    _temp_codec_param = get_temp_codec_param(input[1])
     _artifacts_param = f"--artifacts {artifacts}" if artifacts != "" else ""
     _dont_filter_illumina_adapters_param = "--dont_filter_illumina_adapters" if dont_filter_illumina_adapters else ""
     fname = input[0]
     sample_name = input[1]
-    
+
+    file_format = get_file_format(fname)
+
+    if without_kmc and file_format in ["fq", "fa"]:
+        cmd = f"{satc} \
+            --input_format {file_format} \
+            --anchor_len {anchor_len} \
+            --gap_len {gap_len} \
+            --target_len {target_len} \
+            --n_bins {n_bins} \
+            --n_compression_threads {n_threads_stage_1_internal} \
+            --rec_encoding {bins_rec_encoding} \
+            {_temp_codec_param} \
+            --anchor_sample_counts_threshold {anchor_sample_counts_threshold} \
+            --min_hamming_threshold {min_hamming_threshold} \
+            --poly_ACGT_len {poly_ACGT_len} \
+            {_cohort_prescreen_param} \
+            {anchor_list_param} \
+            {_artifacts_param} \
+            {_dont_filter_illumina_adapters_param} \
+            {get_sample_out_base(sample_name)} \
+            {fname} {id}"
+        run_cmd(cmd, out, err)
+        return
+
+    # sorted kmc database is kept after the first pass of the cohort pre-screen
+    if stage_1_pass != 2:
+        run_kmc(fname, sample_name, file_format, out, err)
+
+    cmd = f"{satc} \
+        --anchor_len {anchor_len} \
+        --target_len {target_len} \
+        --n_bins {n_bins} \
+        --n_threads {n_threads_stage_1_internal} \
+        --n_compression_threads {n_threads_stage_1_internal} \
+        --rec_encoding {bins_rec_encoding} \
+        {_temp_codec_param} \
+        --anchor_sample_counts_threshold {anchor_sample_counts_threshold} \
+        --min_hamming_threshold {min_hamming_threshold} \
+        --poly_ACGT_len {poly_ACGT_len} \
+        {_cohort_prescreen_param} \
+        {anchor_list_param} \
+        {_artifacts_param} \
+        {_dont_filter_illumina_adapters_param} \
+        {get_sample_out_base(sample_name)} \
+        {tmp_dir}/{sample_name}.sorted {id}"
+    run_cmd(cmd, out, err)
+
+    if clean_up and stage_1_pass != 1:
+        remove_kmc_output(f"{tmp_dir}/{sample_name}.sorted")
+
+def run_kmc(fname, sample_name, file_format, out, err):
     kmc_dir_tmp_name = f"{tmp_dir}/kmc_tmp_{sample_name}"
 
     if not os.path.exists(kmc_dir_tmp_name):
@@ -495,8 +656,6 @@ def stage_1_task(id, input, out, err):
     if kmc_use_RAM_only_mode:
         ram_only_param="-r"
 
-    file_format = get_file_format(fname)
-
     gap_len_for_kmc = gap_len
     fname_for_kmc = fname
     
@@ -515,22 +674,6 @@ def stage_1_task(id, input, out, err):
         shutil.copy(f"{tmp_dir}/{sample_name}.kmc_suf", f"{tmp_dir}/{sample_name}.sorted.kmc_suf")
     if clean_up:
         remove_kmc_output(f"{tmp_dir}/{sample_name}")
-    
-    cmd = f"{satc} \
-        --anchor_len {anchor_len} \
-        --target_len {target_len} \
-        --n_bins {n_bins} \
-        --anchor_sample_counts_threshold {anchor_sample_counts_threshold} \
-        --min_hamming_threshold {min_hamming_threshold} \
-        --poly_ACGT_len {poly_ACGT_len} \
-        {_artifacts_param} \
-        {_dont_filter_illumina_adapters_param} \
-        {tmp_dir}/{sample_name} \
-        {tmp_dir}/{sample_name}.sorted {id}"
-    run_cmd(cmd, out, err)
-    
-    if clean_up:
-        remove_kmc_output(f"{tmp_dir}/{sample_name}.sorted")
 
 class action_at_function_exit:
     def __init__(self, action):
@@ -555,38 +698,210 @@ def stage_1_worker(tid):
         action_at_function_exit(lambda: stage_1_queue.task_done()) # will be called even if stage_1_task will raise exception
 
         try:
+            if ram_budget_active():
+                take_ram_budget_sample(input)
             stage_1_task(id, input, stdoutfile, stdoutfile)
+            if ram_budget_active():
+                finish_ram_budget_sample(input)
         except StopAllBecauseCrititcalError: #just consume next task
             pass
 
     stdoutfile.close()
 
 
-stage_1_threads = []
-for i in range(n_threads_stage_1):
-    t = threading.Thread(target=stage_1_worker, args=(i,))
-    t.start()
-    stage_1_threads.append(t)
+# without kmc all samples in the same format are processed by a single satc run
+# (filters and output writers are set up once instead of per each sample)
+def stage_1_batch(ids_inputs, file_format):
+    _cohort_prescreen_param = get_cohort_prescreen_param()
+    _temp_codec_param = get_temp_codec_param()
+    _artifacts_param = f"--artifacts {artifacts}" if artifacts != "" else ""
+    _dont_filter_illumina_adapters_param = "--dont_filter_illumina_adapters" if dont_filter_illumina_adapters else ""
+    batch_path = f"{tmp_dir}/satc_batch.txt"
+    with open(batch_path, "w") as f:
+        for id, input in ids_inputs:
+            f.write(f"{get_sample_out_base(input[1])} {input[0]} {id}\n")
+
+    cmd = f"{satc} \
+        --input_format {file_format} \
+        --anchor_len {anchor_len} \
+        --gap_len {gap_len} \
+        --target_len {target_len} \
+        --n_bins {n_bins} \
+        --n_parallel_samples {n_threads_stage_1} \
+        --n_compression_threads {n_threads_stage_1 * n_threads_stage_1_internal} \
+        --rec_encoding {bins_rec_encoding} \
+        {_temp_codec_param} \
+        --anchor_sample_counts_threshold {anchor_sample_counts_threshold} \
+        --min_hamming_threshold {min_hamming_threshold} \
+        --poly_ACGT_len {poly_ACGT_len} \
+        {_cohort_prescreen_param} \
+        {anchor_list_param} \
+        {_artifacts_param} \
+        {_dont_filter_illumina_adapters_param} \
+        --batch {batch_path}"
+    with open(f"{logs_dir}/stage_1_batch.log", "a") as log:
+        run_cmd(cmd, log, log)
+    if clean_up:
+        os.remove(batch_path)
+
+inputs_formats = set(get_file_format(input[0]) for input in inputs)
 
 for id, input in enumerate(inputs):
     sample_name = input[1]
     sample_name_to_id_file.write(f"{sample_name} {id}\n")
-    stage_1_queue.put((id, input))
 
-stage_1_queue.join()
+# ids_inputs: list of (sample id, input)
+# with temp_ram_budget_GB samples are not processed in batch, so the output of each sample is chosen just before it is processed
+def run_stage_1(ids_inputs):
+    if without_kmc and len(inputs_formats) == 1 and list(inputs_formats)[0] in ["fq", "fa"] and not ram_budget_active():
+        stage_1_batch(ids_inputs, list(inputs_formats)[0])
+        return
+
+    stage_1_threads = []
+    for i in range(n_threads_stage_1):
+        t = threading.Thread(target=stage_1_worker, args=(i,))
+        t.start()
+        stage_1_threads.append(t)
+
+    for id, input in ids_inputs:
+        stage_1_queue.put((id, input))
+
+    stage_1_queue.join()
+
+    # stop workers
+    for i in range(n_threads_stage_1):
+        stage_1_queue.put(None)
+    for t in stage_1_threads:
+        t.join()
+
+def merge_cohort_sketches():
+    sketches_list = f"{tmp_dir}/sketches.lst"
+    with open(sketches_list, "w") as f:
+        for input in inputs:
+            f.write(f"{tmp_dir}/{input[1]}.sketch\n")
+    with open(f"{logs_dir}/merge_sketches.log", "w") as log:
+        run_cmd(f"{satc} --merge_sketches {cohort_sketch_path} {sketches_list}", log, log)
+    if clean_up:
+        os.remove(sketches_list)
+        for input in inputs:
+            os.remove(f"{tmp_dir}/{input[1]}.sketch")
+
+# with temp_ram_budget_GB a stage 1 worker decides when it takes a sample whether its bins are stored in /dev/shm or compressed in tmp_dir
+# the sample is stored in /dev/shm if the bins of samples done, the bins of samples being processed and its own bins fit in the budget
+# size of bins of a sample being processed is its estimate (or the size written so far if larger),
+# the estimate is the input size scaled by the ratio of bins size to input size of the samples done so far (1 before any sample is done)
+# if bins of a sample exceed the budget anyway, they are moved to tmp_dir (not compressed) when the sample is done
+ram_budget_lock = threading.Lock()
+ram_budget_in_progress = {} # sample name -> estimated size of its bins
+ram_budget_used = 0 # size of bins in /dev/shm of samples done
+ram_budget_done_bins_size = 0
+ram_budget_done_input_size = 0
+
+def ram_budget_active():
+    return temp_codec == "ram" and temp_ram_budget_GB > 0 and stage_1_pass != 1
+
+def get_input_size(input):
+    try:
+        return os.path.getsize(input[0])
+    except OSError:
+        return 0
+
+# files of bins of a sample in a given directory
+def get_sample_bins_files(sample_name, dir):
+    if bins_container:
+        return [f"{dir}/{sample_name}.bins", f"{dir}/{sample_name}.bins.spill"]
+    return [f"{dir}/{sample_name}.{bin_id}.bin" for bin_id in range(n_bins)]
+
+def get_sample_bins_size(sample_name):
+    res = 0
+    for path in get_sample_bins_files(sample_name, bins_dir):
+        try:
+            res += os.path.getsize(path)
+        except OSError:
+            pass
+    return res
 
-# stop workers
-for i in range(n_threads_stage_1):
-    stage_1_queue.put(None)
-for t in stage_1_threads:
-    t.join()
+def take_ram_budget_sample(input):
+    sample_name = input[1]
+    budget = temp_ram_budget_GB * (1 << 30)
+    with ram_budget_lock:
+        ratio = ram_budget_done_bins_size / ram_budget_done_input_size if ram_budget_done_input_size > 0 else 1.0
+        estimate = get_input_size(input) * ratio
+        in_progress = sum(max(size, get_sample_bins_size(name)) for name, size in ram_budget_in_progress.items())
+        # the first sample is always stored in /dev/shm (and moved if it does not fit), so the ratio is known as soon as possible
+        first = ram_budget_done_input_size == 0 and not ram_budget_in_progress
+        if not first and ram_budget_used + in_progress + estimate > budget:
+            spilled_samples.add(sample_name)
+            print(f"Bins of sample {sample_name} would exceed --temp_ram_budget_GB, they are stored in {tmp_dir}", flush=True)
+            return
+        ram_budget_in_progress[sample_name] = estimate
+
+def finish_ram_budget_sample(input):
+    global ram_budget_used, ram_budget_done_bins_size, ram_budget_done_input_size
+    sample_name = input[1]
+    budget = temp_ram_budget_GB * (1 << 30)
+    with ram_budget_lock:
+        if sample_name not in ram_budget_in_progress:
+            return
+        del ram_budget_in_progress[sample_name]
+        size = get_sample_bins_size(sample_name)
+        ram_budget_done_bins_size += size
+        ram_budget_done_input_size += get_input_size(input)
+        if ram_budget_used + size <= budget:
+            ram_budget_used += size
+            return
+        spilled_samples.add(sample_name)
+    print(f"Bins of sample {sample_name} exceeded --temp_ram_budget_GB, they are moved to {tmp_dir}", flush=True)
+    for path in get_sample_bins_files(sample_name, bins_dir):
+        if os.path.exists(path):
+            shutil.move(path, tmp_dir)
+
+# the final pass of stage 1 (i.e., the one writing bins)
+def run_stage_1_final():
+    global stage_1_temp_codec
+    ids_inputs = list(enumerate(inputs))
+    n_train_samples = min(3, len(inputs) - 1)
+    if temp_codec != "zstd_dict" or n_train_samples < 1:
+        run_stage_1(ids_inputs)
+        return
+
+    run_stage_1(ids_inputs[:n_train_samples])
+    check_and_handle_error()
+
+    train_list = f"{tmp_dir}/temp_dict_train.lst"
+    with open(train_list, "w") as f:
+        for id, input in ids_inputs[:n_train_samples]:
+            for bin_id in range(n_bins):
+                f.write(get_bin_path(input[1], bin_id) + "\n")
+    with open(f"{logs_dir}/train_temp_dict.log", "w") as log:
+        run_cmd(f"{satc} --train_temp_dict {temp_dict_path} {train_list}", log, log)
+    if clean_up:
+        os.remove(train_list)
+    check_and_handle_error()
+
+    # too little data to train, the rest is compressed without a dictionary
+    if os.path.exists(temp_dict_path):
+        stage_1_temp_codec = "zstd_dict"
+    else:
+        print("Warning: temp dictionary was not trained, --temp_codec zstd is used instead")
+
+    run_stage_1(ids_inputs[n_train_samples:])
+
+if cohort_prescreen:
+    stage_1_pass = 1
+    run_stage_1(list(enumerate(inputs)))
+    check_and_handle_error()
+    merge_cohort_sketches()
+    check_and_handle_error()
+    stage_1_pass = 2
+    run_stage_1_final()
+    if clean_up:
+        os.remove(cohort_sketch_path)
+else:
+    run_stage_1_final()
 check_and_handle_error()
 
 sample_name_to_id_file.close()
-if len(anchor_list):    
-    anchor_list_param = f"--anchor_list {anchor_list}"
-else:
-    anchor_list_param=""
 
 ###############################################################################
 # STAGE 2
@@ -621,7 +936,7 @@ def stage_2_task(bin_id, out, err):
     for input in inputs:
         sample_name = input[1]
 
-        name = f"{tmp_dir}/{sample_name}.{bin_id}.bin"
+        name = get_bin_path(sample_name, bin_id)
 
         satc_merge_inputs.append(name)
         
@@ -636,6 +951,7 @@ def stage_2_task(bin_id, out, err):
     _without_seqence_entropy_param = "--without_seqence_entropy" if without_seqence_entropy else ""
 
     _cjs_out_param = f"--cjs_out {Cjs_dir}/bin{bin_id}.cjs" if dump_Cjs else ""
+    _temp_dict_param = f"--temp_dict {temp_dict_path}" if os.path.exists(temp_dict_path) else ""
 
     _dump_sample_anchor_target_count_txt_param = ""
     if dump_sample_anchor_target_count_txt:
@@ -645,7 +961,7 @@ def stage_2_task(bin_id, out, err):
     _dump_sample_anchor_target_count_binary_param = ""
     if dump_sample_anchor_target_count_binary:
         satc_dir = f"{outname_prefix}_satc"
-        _dump_sample_anchor_target_count_binary_param = f"--dump_sample_anchor_target_count_binary {satc_dir}/bin{bin_id}.satc"
+        _dump_sample_anchor_target_count_binary_param = f"--dump_sample_anchor_target_count_binary {satc_dir}/bin{bin_id}.satc --indexed_binary_dump"
 
     cmd=f"{satc_merge} \
     {_without_alt_max_param} \
@@ -664,6 +980,9 @@ def stage_2_task(bin_id, out, err):
     --num_rand_cf {num_rand_cf} \
     --num_splits {num_splits} \
     --opt_train_fraction {opt_train_fraction} \
+    --n_prefetch_threads {n_prefetch_threads_stage_2} \
+    --n_threads {n_threads_stage_2_internal} \
+    {_temp_dict_param} \
     {_dump_sample_anchor_target_count_txt_param} \
     {_dump_sample_anchor_target_count_binary_param} \
     --sample_names {sample_name_to_id} \
@@ -674,8 +993,9 @@ def stage_2_task(bin_id, out, err):
 
     if clean_up:
         os.remove(in_file_name)
-        for f in satc_merge_inputs:
-            os.remove(f)
+        if not bins_container:
+            for f in satc_merge_inputs:
+                os.remove(f)
 
 
 stage_2_queue = queue.Queue()
@@ -708,7 +1028,14 @@ for i in range(n_threads_stage_2):
     t.start()
     stage_2_threads.append(t)
 
-for bin_id in range(n_bins):
+# with --heavy_bins_first the heaviest bins are merged first, so the longest one is not started last
+# bins are hash partitioned, so their sizes in the first samples are representative
+stage_2_order = list(range(n_bins))
+if heavy_bins_first and n_threads_stage_2 > 1:
+    bin_weights = [sum(x) for x in zip(*[get_bins_n_recs(input[1]) for input in inputs[:32]])]
+    stage_2_order.sort(key=lambda bin_id: -bin_weights[bin_id])
+
+for bin_id in stage_2_order:
     stage_2_queue.put(bin_id)
 
 stage_2_queue.join()
@@ -720,6 +1047,11 @@ for t in stage_2_threads:
     t.join()
 check_and_handle_error()
 
+# containers are shared by all bins
+if clean_up and bins_container:
+    for input in inputs:
+        os.remove(f"{get_sample_bins_dir(input[1])}/{input[1]}.bins")
+
 timer.catch("stage_2")
 print("Stage 2 done")
 print("Starting stage 3")
@@ -827,6 +1159,10 @@ with open(f"{logs_dir}/timings.json", "w") as f:
     f.write(json.dumps(timer.timings, indent="\t"))
 
 if clean_up:
+    if os.path.exists(temp_dict_path):
+        os.remove(temp_dict_path)
+    if bins_dir != tmp_dir:
+        os.rmdir(bins_dir)
     os.rmdir(tmp_dir)
 check_and_handle_error()
 